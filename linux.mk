@@ -0,0 +1,144 @@
+#---------------------------------------------------------------------------------
+# Headless Linux host build (TARGET_LINUX), included by the main Makefile for the
+# prizoop-headless, headless-clean and bench-* goals. Builds the emulation core against the
+# fxcg stand-ins in src/linux, without the menu screens or sound output.
+#
+# HOST_DEFINES may be used to pass extra -D options, i.e. for A/B benchmarking.
+#---------------------------------------------------------------------------------
+
+HOST_CXX		?=	g++
+HOST_BUILD		:=	linux_build
+HOST_TARGET		:=	prizoop-headless
+
+HOST_CXXFLAGS	=	-O2 -g \
+		  -std=gnu++17 \
+		  -Wall \
+		  -Wno-switch \
+		  -Wno-class-memaccess \
+		  -fno-rtti \
+		  -fno-exceptions \
+		  -fpermissive \
+		  -DTARGET_LINUX=1 \
+		  -DDEBUG=0 \
+		  -Isrc -Isrc/linux \
+		  $(HOST_DEFINES)
+
+HOST_LDFLAGS	=
+
+# core emulation files only, main.cpp, emulator.cpp and the screens depend on the Prizm OS menus
+HOST_SOURCES	:=	src/cpu.cpp \
+		  src/memory.cpp \
+		  src/mbc.cpp \
+		  src/gpu.cpp \
+		  src/gpu_thread.cpp \
+		  src/interrupts.cpp \
+		  src/timer.cpp \
+		  src/events.cpp \
+		  src/cgb.cpp \
+		  src/cgb_bootstrap.cpp \
+		  src/display_emu.cpp \
+		  src/display_preview.cpp \
+		  src/keys.cpp \
+		  src/snd_main.cpp \
+		  src/bit_table.cpp \
+		  src/rom.cpp \
+		  src/emulator_state.cpp \
+		  $(wildcard src/linux/*.cpp)
+
+HOST_OFILES		:=	$(addprefix $(HOST_BUILD)/,$(notdir $(HOST_SOURCES:.cpp=.o)))
+
+vpath %.cpp src src/linux
+
+.PHONY: prizoop-headless headless-clean bench-check bench-dispatch bench-blocks bench-jit bench-flags bench-idle bench-ppu bench-lines
+
+prizoop-headless: $(HOST_TARGET)
+
+$(HOST_TARGET): $(HOST_OFILES)
+	$(HOST_CXX) $(HOST_LDFLAGS) -o $@ $^
+
+$(HOST_BUILD)/%.o: %.cpp | $(HOST_BUILD)
+	$(HOST_CXX) $(HOST_CXXFLAGS) -MMD -MP -c $< -o $@
+
+$(HOST_BUILD):
+	mkdir -p $@
+
+headless-clean:
+	rm -rf $(HOST_BUILD) $(HOST_TARGET)
+
+#---------------------------------------------------------------------------------
+# benchmarks, each builds variants of the headless target with different defines
+# and runs them back to back on BENCH_ROM, i.e.
+#   make bench-dispatch BENCH_ROM=roms/MyGame.gb
+#---------------------------------------------------------------------------------
+
+BENCH_ROM		?=
+BENCH_FRAMES	?=	3000
+BENCH_THREADS	?=	1 2 4 8 16
+
+# $(call host_variant,name,defines) builds linux_build/name/prizoop-headless
+define host_variant
+	@$(MAKE) --no-print-directory prizoop-headless HOST_BUILD=$(HOST_BUILD)/$(1) HOST_TARGET=$(HOST_BUILD)/$(1)/$(HOST_TARGET) HOST_DEFINES="$(HOST_DEFINES) $(2)"
+endef
+
+# $(call bench_variant,name) runs a built variant on the benchmark ROM
+define bench_variant
+	@echo "== $(1)"
+	@$(HOST_BUILD)/$(1)/$(HOST_TARGET) $(BENCH_ROM) -frames $(BENCH_FRAMES) | sed -n '/^Frames:/,$$p'
+endef
+
+bench-check:
+	@test -n "$(BENCH_ROM)" || (echo "BENCH_ROM must be set to a ROM file" && false)
+
+# switch vs threaded code instruction dispatch in cpuStep
+bench-dispatch: bench-check
+	$(call host_variant,switch,-DTHREADED_DISPATCH=0 -DBLOCK_CACHE=0)
+	$(call host_variant,threaded,-DTHREADED_DISPATCH=1 -DBLOCK_CACHE=0)
+	$(call bench_variant,switch)
+	$(call bench_variant,threaded)
+
+# threaded dispatch with and without the predecoded basic block cache
+bench-blocks: bench-check
+	$(call host_variant,threaded,-DTHREADED_DISPATCH=1 -DBLOCK_CACHE=0)
+	$(call host_variant,blocks,-DTHREADED_DISPATCH=1 -DBLOCK_CACHE=1)
+	$(call bench_variant,threaded)
+	$(call bench_variant,blocks)
+
+# block cache interpreter vs the x86-64 recompiler
+bench-jit: bench-check
+	$(call host_variant,blocks,-DTHREADED_DISPATCH=1 -DBLOCK_CACHE=1)
+	$(call host_variant,jit,-DCPU_JIT=1)
+	$(call bench_variant,blocks)
+	$(call bench_variant,jit)
+
+# eager vs lazy flag evaluation
+bench-flags: bench-check
+	$(call host_variant,eager,-DLAZY_FLAGS=0)
+	$(call host_variant,lazy,-DLAZY_FLAGS=1)
+	$(call bench_variant,eager)
+	$(call bench_variant,lazy)
+
+# with and without busy wait loop skipping
+bench-idle: bench-check
+	$(call host_variant,noidle,-DIDLE_LOOP_SKIP=0)
+	$(call host_variant,idle,-DIDLE_LOOP_SKIP=1)
+	$(call bench_variant,noidle)
+	$(call bench_variant,idle)
+
+# drawing the lines on the cpu thread vs the PPU worker thread
+bench-ppu: bench-check
+	$(call host_variant,noppu,-DPPU_THREAD=0)
+	$(call host_variant,ppu,-DPPU_THREAD=1)
+	$(call bench_variant,noppu)
+	$(call bench_variant,ppu)
+
+# drawing the catch-up batches on the cpu thread vs across BENCH_THREADS render threads
+bench-lines: bench-check
+	$(call host_variant,serial,-DPARALLEL_LINES=0)
+	$(call host_variant,lines,-DPARALLEL_LINES=1)
+	$(call bench_variant,serial)
+	@for threads in $(BENCH_THREADS); do \
+		echo "== lines, $$threads threads"; \
+		$(HOST_BUILD)/lines/$(HOST_TARGET) $(BENCH_ROM) -frames $(BENCH_FRAMES) -threads $$threads | sed -n '/^Frames:/,$$p'; \
+	done
+
+-include $(HOST_OFILES:.o=.d)
@@ -4,11 +4,15 @@
 FORCE_INLINE unsigned char rlc(unsigned char value) {
 	value = (value << 1) | (value >> 7);
 
+#if LAZY_FLAGS
+	FLAGS_LAZY(FLAGOP_SHIFT, 0, 0, 0, value, (value & 0x01) << FLAGS_C_BIT);
+#else
 	cpu.registers.f =
 		((value == 0) << FLAGS_Z_BIT) |										// ZERO
 		0 |																	// NEGATIVE
 		0 |																	// HALF-CARRY
 		((value & 0x01) << FLAGS_C_BIT);									// CARRY
+#endif
 
 	return value;
 }
@@ -16,11 +20,15 @@ FORCE_INLINE unsigned char rlc(unsigned char value) {
 FORCE_INLINE unsigned char rrc(unsigned char value) {
 	value = (value >> 1) | ((value << 7) & 0x80);
 
+#if LAZY_FLAGS
+	FLAGS_LAZY(FLAGOP_SHIFT, 0, 0, 0, value, (value & 0x80) >> (7 - FLAGS_C_BIT));
+#else
 	cpu.registers.f =
 		((value == 0) << FLAGS_Z_BIT) |										// ZERO
 		0 |																	// NEGATIVE
 		0 |																	// HALF-CARRY
 		((value & 0x80) >> (7 - FLAGS_C_BIT));								// CARRY
+#endif
 
 	return value;
 }
@@ -30,11 +38,15 @@ FORCE_INLINE unsigned char rl(unsigned char value) {
 
 	value = (value << 1) | ((FLAGS_ISCARRY) >> FLAGS_C_BIT);
 
+#if LAZY_FLAGS
+	FLAGS_LAZY(FLAGOP_SHIFT, 0, 0, 0, value, carry);
+#else
 	cpu.registers.f =
 		((value == 0) << FLAGS_Z_BIT) |										// ZERO
 		0 |																	// NEGATIVE
 		0 |																	// HALF-CARRY
 		carry;																// CARRY
+#endif
 
 	return value;
 }
@@ -42,24 +54,32 @@ FORCE_INLINE unsigned char rl(unsigned char value) {
 FORCE_INLINE unsigned char rr(unsigned char value) {
 	unsigned int carry = (value & 0x01) << FLAGS_C_BIT;
 
-	value = (value >> 1) | ((cpu.registers.f & FLAGS_C) << (7 - FLAGS_C_BIT));
+	value = (value >> 1) | ((FLAGS_ISCARRY) << (7 - FLAGS_C_BIT));
 
+#if LAZY_FLAGS
+	FLAGS_LAZY(FLAGOP_SHIFT, 0, 0, 0, value, carry);
+#else
 	cpu.registers.f =
 		((value == 0) << FLAGS_Z_BIT) |										// ZERO
 		0 |																	// NEGATIVE
 		0 |																	// HALF-CARRY
 		carry;																// CARRY
+#endif
 
 	return value;
 }
 
 
 FORCE_INLINE unsigned char sla(unsigned char value) {
+#if LAZY_FLAGS
+	FLAGS_LAZY(FLAGOP_SHIFT, 0, 0, 0, (value << 1) & 0xFF, (value & 0x80) >> (7 - FLAGS_C_BIT));
+#else
 	cpu.registers.f =
 		(((value & 0x7F) == 0) << FLAGS_Z_BIT) |							// ZERO
 		0 |																	// NEGATIVE
 		0 |																	// HALF-CARRY
 		((value & 0x80) >> (7 - FLAGS_C_BIT));								// CARRY
+#endif
 
 	value <<= 1;
 
@@ -67,11 +87,15 @@ FORCE_INLINE unsigned char sla(unsigned char value) {
 }
 
 FORCE_INLINE unsigned char sra(unsigned char value) {
+#if LAZY_FLAGS
+	FLAGS_LAZY(FLAGOP_SHIFT, 0, 0, 0, (value & 0x80) | (value >> 1), (value & 0x01) << FLAGS_C_BIT);
+#else
 	cpu.registers.f =
 		(((value & 0xFE) == 0) << FLAGS_Z_BIT) |							// ZERO
 		0 |																	// NEGATIVE
 		0 |																	// HALF-CARRY
 		((value & 0x01) << FLAGS_C_BIT);									// CARRY
+#endif
 
 	value = (value & 0x80) | (value >> 1);
 
@@ -81,21 +105,29 @@ FORCE_INLINE unsigned char sra(unsigned char value) {
 FORCE_INLINE unsigned char swap(unsigned char value) {
 	value = ((value & 0xf) << 4) | ((value & 0xf0) >> 4);
 
+#if LAZY_FLAGS
+	FLAGS_LAZY(FLAGOP_SHIFT, 0, 0, 0, value, 0);
+#else
 	cpu.registers.f =
 		((value == 0) << FLAGS_Z_BIT) |										// ZERO
 		0 |																	// NEGATIVE
 		0 |																	// HALF-CARRY
 		0;																	// CARRY
+#endif
 
 	return value;
 }
 
 FORCE_INLINE unsigned char srl(unsigned char value) {
+#if LAZY_FLAGS
+	FLAGS_LAZY(FLAGOP_SHIFT, 0, 0, 0, value >> 1, (value & 0x01) << FLAGS_C_BIT);
+#else
 	cpu.registers.f =
 		(((value & 0xFE) == 0) << FLAGS_Z_BIT) |							// ZERO
 		0 |																	// NEGATIVE
 		0 |																	// HALF-CARRY
 		((value & 0x01) << FLAGS_C_BIT);									// CARRY
+#endif
 
 	value >>= 1;
 
@@ -104,22 +136,30 @@ FORCE_INLINE unsigned char srl(unsigned char value) {
 
 FORCE_INLINE void bit(unsigned char bit, unsigned char value) {
 	// carry uneffected
+#if LAZY_FLAGS
+	FLAGS_LAZY(FLAGOP_BIT, 0, 0, 0, value & bit, FLAGS_ISCARRY);
+#else
 	cpu.registers.f =
 		(((value & bit) == 0) << FLAGS_Z_BIT) |								// ZERO
 		0 |																	// NEGATIVE
 		(FLAGS_HC) |														// HALF-CARRY
 		(FLAGS_ISCARRY);													// CARRY
+#endif
 
 }
 
 template<int bitNum>
 FORCE_INLINE void bit(unsigned char value) {
 	// carry uneffected
+#if LAZY_FLAGS
+	FLAGS_LAZY(FLAGOP_BIT, 0, 0, 0, value & (1 << bitNum), FLAGS_ISCARRY);
+#else
 	cpu.registers.f =
 		(((value & (1 << bitNum)) == 0) << FLAGS_Z_BIT) |					// ZERO
 		0 |																	// NEGATIVE
 		(FLAGS_HC) |														// HALF-CARRY
 		(FLAGS_ISCARRY);													// CARRY
+#endif
 }
 
 FORCE_INLINE void set(unsigned char bit, unsigned char& value) {
@@ -327,11 +367,15 @@ inline void srl_hlp(void) { writeByte(cpu.registers.hl, srl(readByte(cpu.registe
 
 // 0x3f
 inline void srl_a(void) {
+#if LAZY_FLAGS
+	FLAGS_LAZY(FLAGOP_SHIFT, 0, 0, 0, cpu.registers.a >> 1, (cpu.registers.a & 0x01) << FLAGS_C_BIT);
+#else
 	cpu.registers.f =
 		(((cpu.registers.a & 0xFE) == 0) << FLAGS_Z_BIT) |										// ZERO
 		0 |																						// NEGATIVE
 		0 |																						// HALF-CARRY
 		((cpu.registers.a & 0x01) << FLAGS_C_BIT);												// CARRY
+#endif
 
 	cpu.registers.a >>= 1;
 }
@@ -1,4 +1,3 @@
-#pragma once
 
 // used for extended CPU instruction list (after cb instruction)
 
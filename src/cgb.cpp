@@ -73,11 +73,13 @@ void cgbSelectWRAM(int ramBank, bool force) {
 		}
 
 		for (int i = 0xd0; i <= 0xdf; i++) {
-			memoryMap[i] = &selected[(i - 0xd0) << 8];
+			mapMemoryPage(i, &selected[(i - 0xd0) << 8]);
+			cpuPageTouched(i);
 		}
 		// echo area of above ram
 		for (int i = 0xf0; i <= 0xfd; i++) {
-			memoryMap[i] = &selected[(i - 0xe0) << 8];
+			mapMemoryPage(i, &selected[(i - 0xe0) << 8]);
+			cpuPageTouched(i);
 		}
 	}
 }
@@ -89,7 +91,8 @@ void cgbSelectVRAM(int ramBank, bool force) {
 		cgb.selectedVRAM = ramBank;
 
 		for (int i = 0x80; i <= 0x9f; i++) {
-			memoryMap[i] = &vram[(i - 0x80 + 0x20 * ramBank) << 8];
+			mapVRAMPage(i, &vram[(i - 0x80 + 0x20 * ramBank) << 8]);
+			cpuPageTouched(i);
 		}
 	}
 }
@@ -119,12 +122,14 @@ inline void cgbDmaCopyBits() {
 		source -= 0x4000;
 	}
 
-	if (specialMap[source >> 8] & 0x10) {
-		// needs mbc validation
-		mbcRead(source);
-	}
-
-	memcpy(&memoryMap[cgb.dmaDest >> 8][cgb.dmaDest & 0xFF], &memoryMap[source >> 8][source & 0xFF], 16);
+	// validates the source if it is a switched bank
+	unsigned char* dest = &readMap[cgb.dmaDest >> 8][cgb.dmaDest & 0xFF];
+	gpuCatchUp();
+	memcpy(dest, getInstrByte(source), 16);
+	cpuPageTouched(cgb.dmaDest >> 8);
+#if VRAM_WRITE_TRACKING
+	gpuVRAMChanged(dest - vram, 16);
+#endif
 
 	cgb.dmaLeft -= 16;
 	cgb.dmaSrc += 16;
@@ -139,6 +144,8 @@ inline void cgbDmaCopyBits() {
 void cgbDMAOp(unsigned char value) {
 	// only support general DMA right now:
 	if (value & 0x80) {
+		// copies happen at the hblank transitions
+		gpuLeaveFastLine();
 		cgb.hblankDmaActive = true;
 		cpu.memory.HDMA5_cgbstat = value & 0x7F;
 		cgb.dmaLeft = ((value & 0x7F) + 1) << 4;
@@ -18,29 +18,46 @@ inline bool RenderCGBScanline_BG() {
 		int i;
 
 		// tile offset and palette shared for window
-		const int tileOffset = (cpu.memory.LCDC_ctl & LCDC_TILESET) ? 0 : 256;
+		const int tileOffset = (gpuLineRegs.lcdc & LCDC_TILESET) ? 0 : 256;
 
 		// draw background
 		{
-			int y = (cpu.memory.LY_lcdline + cpu.memory.SCY_bgscrolly) & 7;
+			int y = (gpuLineRegs.line + gpuLineRegs.scy) & 7;
 
 			int yVal[2];
 			yVal[0] = y * 2;
 			yVal[1] = (7 - y) * 2;
 
-			int mapOffset = (cpu.memory.LCDC_ctl & LCDC_BGTILEMAP) ? 0x1c00 : 0x1800;
-			mapOffset += (((cpu.memory.LY_lcdline + cpu.memory.SCY_bgscrolly) & 255) >> 3) << 5;
+			int mapOffset = (gpuLineRegs.lcdc & LCDC_BGTILEMAP) ? 0x1c00 : 0x1800;
+			mapOffset += (((gpuLineRegs.line + gpuLineRegs.scy) & 255) >> 3) << 5;
 
 			// always start at pixel 8 for alignment, store 7 pixel alignment in unused 0th index
 			unsigned char* scanline = &lineBuffer[8];
-			lineBuffer[0] = cpu.memory.SCX_bgscrollx & 7;
+			lineBuffer[0] = gpuLineRegs.scx & 7;
+
+			int firstPixel = 0;
+#if BG_SURFACE
+			// lines without BG priority tiles are copied straight from the map's surface
+			if (!priorityBG && bgSurface) {
+				const unsigned int map = (gpuLineRegs.lcdc & LCDC_BGTILEMAP) ? 1 : 0;
+				const unsigned int surfaceY = (gpuLineRegs.line + gpuLineRegs.scy) & 255;
+				const unsigned char* surfaceLine = bgSurfaceLine(map, surfaceY);
+				if (!bgSurfaceLinePriority(map, surfaceY)) {
+					bgSurfaceCopy(scanline, surfaceLine, gpuLineRegs.scx & 0xF8, 168);
+					firstPixel = 168;
+				}
+			}
+#endif
 
-			for (i = 0; i < 168; i += 8) {
-				int lineOffset = ((unsigned char)(cpu.memory.SCX_bgscrollx + i)) >> 3;
+			for (i = firstPixel; i < 168; i += 8) {
+				int lineOffset = ((unsigned char)(gpuLineRegs.scx + i)) >> 3;
 
+				// priority tiles are drawn in both passes like the window's so no pixels are left from the last line,
+				// the second pass only draws them again over the sprites
 				int attr = vram[mapOffset + lineOffset + 0x2000];
-				if (((attr & 0x80) == 0) == priorityBG) {
+				if (attr & 0x80) {
 					hasPriority = true;
+				} else if (priorityBG) {
 					scanline += 8;
 					continue;
 				}
@@ -49,8 +66,7 @@ inline bool RenderCGBScanline_BG() {
 				if (!(tile & 0x80)) tile += tileOffset;
 
 				// attribute bit 3 is vram bank number, bit 6 is yflip
-				unsigned int tileRow = *((unsigned short*)&vram[tile * 16 + yVal[(attr & 0x40) >> 6] + ((attr & 0x8) << 10)]);
-				ShortSwap(tileRow);
+				const unsigned int tileIndex = tile * 16 + yVal[(attr & 0x40) >> 6] + ((attr & 0x8) << 10);
 
 				// attribute bit 0-2 is bg palette
 				int paletteMask = (attr & 0x07) << 4;
@@ -58,9 +74,9 @@ inline bool RenderCGBScanline_BG() {
 				if (priorityBG) {
 					// bit 5 is hflip
 					if (attr & 0x20) {
-						resolveTileRowReverse<false>(priorityLine, tileRow);
+						drawTileRowReverse<false>(priorityLine, tileIndex);
 					} else {
-						resolveTileRow<false>(priorityLine, tileRow);
+						drawTileRow<false>(priorityLine, tileIndex);
 					}
 
 					if (priorityLine[0]) scanline[0] = priorityLine[0] | paletteMask;
@@ -74,9 +90,9 @@ inline bool RenderCGBScanline_BG() {
 				} else {
 					// bit 5 is hflip
 					if (attr & 0x20) {
-						resolveTileRowReversePal<false>(paletteMask, scanline, tileRow);
+						drawTileRowReversePal<false>(paletteMask, scanline, tileIndex);
 					} else {
-						resolveTileRowPal<false>(paletteMask, scanline, tileRow);
+						drawTileRowPal<false>(paletteMask, scanline, tileIndex);
 					}
 				}
 
@@ -85,25 +101,37 @@ inline bool RenderCGBScanline_BG() {
 		}
 
 		// draw window
-		if (cpu.memory.LCDC_ctl & LCDC_WINDOWENABLE)
+		if (gpuLineRegs.lcdc & LCDC_WINDOWENABLE)
 		{
-			int wx = cpu.memory.WX_windowx;
-			int y = cpu.memory.LY_lcdline - cpu.memory.WY_windowy + windowLineOffset;
+			int wx = gpuLineRegs.wx;
+			int y = gpuLineRegs.line - gpuLineRegs.wy + gpuLineRegs.windowLine;
 
 			if (wx <= 166 && y >= 0) {
 				// select map offset row
-				int mapOffset = (cpu.memory.LCDC_ctl & LCDC_WINDOWTILEMAP) ? 0x1c00 : 0x1800;
+				int mapOffset = (gpuLineRegs.lcdc & LCDC_WINDOWTILEMAP) ? 0x1c00 : 0x1800;
 				mapOffset += (y >> 3) << 5;
 
+				unsigned char* scanline = &lineBuffer[wx+1+lineBuffer[0]];
+				bool unsafeAlignment = (size_t(scanline) & 3) != 0;
+
+#if BG_SURFACE
+				if (!priorityBG && bgSurface && y < 256) {
+					const unsigned int map = (gpuLineRegs.lcdc & LCDC_WINDOWTILEMAP) ? 1 : 0;
+					const unsigned char* surfaceLine = bgSurfaceLine(map, y);
+					if (!bgSurfaceLinePriority(map, y)) {
+						// whole tiles up to the right edge, leaves nothing for the tile loop below
+						bgSurfaceCopy(scanline, surfaceLine, 0, (174 - wx) & ~7);
+						wx = 167;
+					}
+				}
+#endif
+
 				int lineOffset = -1;
 				y &= 0x07;
 				int yVal[2];
 				yVal[0] = y * 2;
 				yVal[1] = (7 - y) * 2;
 
-				unsigned char* scanline = &lineBuffer[wx+1+lineBuffer[0]];
-				bool unsafeAlignment = (size_t(scanline) & 3) != 0;
-
 				for (; wx < 167; wx += 8) {
 					lineOffset = lineOffset + 1;
 
@@ -118,8 +146,7 @@ inline bool RenderCGBScanline_BG() {
 					if (!(tile & 0x80)) tile += tileOffset;
 
 					// attribute bit 3 is vram bank number, bit 6 is yflip
-					unsigned int tileRow = *((unsigned short*)&vram[tile * 16 + yVal[(attr & 0x40) >> 6] + ((attr & 0x8) << 10)]);
-					ShortSwap(tileRow);
+					const unsigned int tileIndex = tile * 16 + yVal[(attr & 0x40) >> 6] + ((attr & 0x8) << 10);
 
 					// attribute bit 0-2 is bg palette
 					int paletteMask = (attr & 0x07) << 4;
@@ -127,9 +154,9 @@ inline bool RenderCGBScanline_BG() {
 					if (priorityBG) {
 						// bit 5 is hflip
 						if (attr & 0x20) {
-							resolveTileRowReverse<false>(priorityLine, tileRow);
+							drawTileRowReverse<false>(priorityLine, tileIndex);
 						} else {
-							resolveTileRow<false>(priorityLine, tileRow);
+							drawTileRow<false>(priorityLine, tileIndex);
 						}
 
 						if (priorityLine[0]) scanline[0] = priorityLine[0] | paletteMask;
@@ -145,16 +172,16 @@ inline bool RenderCGBScanline_BG() {
 						if (unsafeAlignment) {
 							// bit 5 is hflip
 							if (attr & 0x20) {
-								resolveTileRowReversePal<true>(paletteMask, scanline, tileRow);
+								drawTileRowReversePal<true>(paletteMask, scanline, tileIndex);
 							} else {
-								resolveTileRowPal<true>(paletteMask, scanline, tileRow);
+								drawTileRowPal<true>(paletteMask, scanline, tileIndex);
 							}
 						} else {
 							// bit 5 is hflip
 							if (attr & 0x20) {
-								resolveTileRowReversePal<false>(paletteMask, scanline, tileRow);
+								drawTileRowReversePal<false>(paletteMask, scanline, tileIndex);
 							} else {
-								resolveTileRowPal<false>(paletteMask, scanline, tileRow);
+								drawTileRowPal<false>(paletteMask, scanline, tileIndex);
 							}
 						}
 					}
@@ -172,11 +199,11 @@ inline void RenderCGBScanline() {
 	bool hasPriority = RenderCGBScanline_BG<false>();
 
 	// if sprites enabled
-	if (cpu.memory.LCDC_ctl & LCDC_SPRITEENABLE)
+	if (gpuLineRegs.lcdc & LCDC_SPRITEENABLE)
 	{
 		int spriteSize;
 		int tileMask;
-		if (cpu.memory.LCDC_ctl & LCDC_SPRITEVDOUBLE) {
+		if (gpuLineRegs.lcdc & LCDC_SPRITEVDOUBLE) {
 			spriteSize = 15;
 			tileMask = 0xFE;
 		} else {
@@ -185,36 +212,35 @@ inline void RenderCGBScanline() {
 		}
 
 		// BG enable flag for CGB means allowng BG over sprite priority
-		bool forceSpritePriority = (cpu.memory.LCDC_ctl & LCDC_BGENABLE);
+		bool forceSpritePriority = (gpuLineRegs.lcdc & LCDC_BGENABLE);
 
+#if SPRITE_LISTS
+		const gpu_spriteline& spriteLine = getSpriteLine(gpuLineRegs.line);
+		for (int i = 0; i < spriteLine.count; i++) {
+			const sprite_type* sprite = (const sprite_type*)(&oam[spriteLine.sprites[i] << 2]);
+#else
 		sprite_type* sprite = (struct sprite_type *) &oam[156];
 		for (int i = 39; i >= 0; i--, sprite--) {
+#endif
 
 			if (sprite->x && sprite->x < 168) {
 				int sy = sprite->y - 16;
 
-				if (sy <= cpu.memory.LY_lcdline && (sy + spriteSize) >= cpu.memory.LY_lcdline) {
+				if (sy <= gpuLineRegs.line && (sy + spriteSize) >= gpuLineRegs.line) {
 					// sprite position
 					unsigned char* scanline = &lineBuffer[sprite->x + lineBuffer[0]];
 
 					int y;
 					int tile = sprite->tile;
 
-					if (OAM_ATTR_YFLIP(sprite->attr)) y = spriteSize - (cpu.memory.LY_lcdline - sy);
-					else y = cpu.memory.LY_lcdline - sy;
+					if (OAM_ATTR_YFLIP(sprite->attr)) y = spriteSize - (gpuLineRegs.line - sy);
+					else y = gpuLineRegs.line - sy;
 					tile &= tileMask;
 
 					// bit 3 is vram bank #
 					int tileIndex = tile * 16 + y * 2 + (OAM_ATTR_BANK(sprite->attr) << 10);
-					unsigned int tileRow = *((unsigned short*)&vram[tileIndex]);
-					ShortSwap(tileRow);
-
-					unsigned char colors[8];
-					if (!OAM_ATTR_XFLIP(sprite->attr)) {
-						resolveTileRow<false>(colors, tileRow);
-					} else {
-						resolveTileRowReverse<false>(colors, tileRow);
-					}
+					unsigned char colorBuffer[8];
+					const unsigned char* colors = getTileRowColors(colorBuffer, tileIndex, OAM_ATTR_XFLIP(sprite->attr) != 0);
 
 					// bit 0-2 are palette #'s for CGB
 					int paletteBase = (32 + (OAM_ATTR_PAL_NUM(sprite->attr) << 2)) << 2;
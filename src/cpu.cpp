@@ -12,6 +12,8 @@
 #include "cgb.h"
 #include "snd/snd.h"
 #include "emulator.h"
+#include "mbc.h"
+#include "events.h"
 
 cpu_type cpu ALIGN(256);
 
@@ -35,24 +37,277 @@ CT_ASSERT(sizeof(cpu.memory) == 0x100);
 	NO$GMB
 */
 
-// max number of cpu instructions to batch between GPU/interrupt checks (higher = less accurate, faster emulation)
-#define MAX_CPU_BATCH 12
+// number of event dispatches to do between system checks
+#define BATCHES 1024
 
-// min number of cpu instructions to batch between GPU/interrupt checks (higher = less accurate, faster emulation)
-#define MIN_CPU_BATCH 4
+#if IDLE_LOOP_SKIP
+cpu_idlestats cpuIdleStats;
+unsigned int cpuIdleLoopPC = 0xFFFFFFFF;
+unsigned int cpuIdleLoopRejected = 0xFFFFFFFF;
+static unsigned int idleLoopClocks = 0;
+
+// registers as seen by the idle loop check, the flags are split since BIT leaves the carry alone
+#define IDLE_REG_A 0x01
+#define IDLE_REG_B 0x02
+#define IDLE_REG_C 0x04
+#define IDLE_REG_D 0x08
+#define IDLE_REG_E 0x10
+#define IDLE_REG_H 0x20
+#define IDLE_REG_L 0x40
+#define IDLE_FLAGS_Z 0x80		// Z, N and H
+#define IDLE_FLAGS_C 0x100
+
+// memory reads in the loop, the register based ones are checked against the current registers before each skip
+enum idle_read {
+	IDLE_READ_ADDRESS = 0,
+	IDLE_READ_C,
+	IDLE_READ_BC,
+	IDLE_READ_DE,
+	IDLE_READ_HL,
+};
 
-// number of batches to do between system checks
-#define BATCHES 1024
+// loops checked so far, direct mapped on the start address
+#define IDLE_LOOP_CACHE 8
+
+static struct cpu_idleloop {
+	const unsigned char* code;
+	unsigned int size;
+	bool idle;
+	unsigned char bytes[IDLE_LOOP_MAX_SIZE];	// loops in RAM could be rewritten
+	unsigned int numReads;
+	unsigned char readType[IDLE_LOOP_MAX_SIZE];
+	unsigned short readAddress[IDLE_LOOP_MAX_SIZE];
+} idleLoops[IDLE_LOOP_CACHE];
+
+// LD r index to register bits, 6 is (HL)
+static const unsigned short idleRegBits[8] = {
+	IDLE_REG_B, IDLE_REG_C, IDLE_REG_D, IDLE_REG_E, IDLE_REG_H, IDLE_REG_L, IDLE_REG_H | IDLE_REG_L, IDLE_REG_A
+};
+
+static unsigned int idleLoopRegRead(cpu_idleloop& idleLoop, unsigned int index) {
+	if (index == 6) {
+		idleLoop.readType[idleLoop.numReads++] = IDLE_READ_HL;
+	}
+	return idleRegBits[index];
+}
+
+// a loop is a busy wait if it only reads memory, and every register it changes is set before it is used. Then every
+// iteration after the first does exactly the same thing until something outside the cpu (an event) changes memory
+static bool idleLoopScan(cpu_idleloop& idleLoop, const unsigned char* code, unsigned int size, unsigned int start) {
+	unsigned int written = 0;
+	unsigned int readFirst = 0;
+	unsigned int i = 0;
+
+	idleLoop.numReads = 0;
+
+	while (i < size) {
+		const unsigned char op = code[i];
+		unsigned int reads = 0;
+		unsigned int writes = 0;
+		unsigned int length = 1;
+		bool jump = false;
+
+		switch (op) {
+			case 0x00:
+				// NOP
+				break;
+			case 0xf0:
+				// LDH A, (n)
+				idleLoop.readType[idleLoop.numReads] = IDLE_READ_ADDRESS;
+				idleLoop.readAddress[idleLoop.numReads++] = 0xFF00 | code[i + 1];
+				writes = IDLE_REG_A;
+				length = 2;
+				break;
+			case 0xf2:
+				// LD A, (C)
+				idleLoop.readType[idleLoop.numReads++] = IDLE_READ_C;
+				reads = IDLE_REG_C;
+				writes = IDLE_REG_A;
+				break;
+			case 0xfa:
+				// LD A, (nn)
+				idleLoop.readType[idleLoop.numReads] = IDLE_READ_ADDRESS;
+				idleLoop.readAddress[idleLoop.numReads++] = code[i + 1] | (code[i + 2] << 8);
+				writes = IDLE_REG_A;
+				length = 3;
+				break;
+			case 0x0a:
+			case 0x1a:
+				// LD A, (BC) / LD A, (DE)
+				idleLoop.readType[idleLoop.numReads++] = op == 0x0a ? IDLE_READ_BC : IDLE_READ_DE;
+				reads = op == 0x0a ? IDLE_REG_B | IDLE_REG_C : IDLE_REG_D | IDLE_REG_E;
+				writes = IDLE_REG_A;
+				break;
+			case 0xfe:
+				// CP n
+				reads = IDLE_REG_A;
+				writes = IDLE_FLAGS_Z | IDLE_FLAGS_C;
+				length = 2;
+				break;
+			case 0xe6:
+			case 0xee:
+			case 0xf6:
+				// AND n / XOR n / OR n
+				reads = IDLE_REG_A;
+				writes = IDLE_REG_A | IDLE_FLAGS_Z | IDLE_FLAGS_C;
+				length = 2;
+				break;
+			case 0xcb:
+				// BIT b, r
+				if (code[i + 1] < 0x40 || code[i + 1] >= 0x80)
+					return false;
+				reads = idleLoopRegRead(idleLoop, code[i + 1] & 7);
+				writes = IDLE_FLAGS_Z;
+				length = 2;
+				break;
+			case 0x18:
+			case 0x20:
+			case 0x28:
+			case 0x30:
+			case 0x38:
+				// JR, JR cc
+				if (i + 2 + (signed char) code[i + 1] != 0)
+					return false;
+				reads = op == 0x18 ? 0 : (op < 0x30 ? IDLE_FLAGS_Z : IDLE_FLAGS_C);
+				length = 2;
+				jump = true;
+				break;
+			case 0xc3:
+			case 0xc2:
+			case 0xca:
+			case 0xd2:
+			case 0xda:
+				// JP, JP cc
+				if ((unsigned int) (code[i + 1] | (code[i + 2] << 8)) != start)
+					return false;
+				reads = op == 0xc3 ? 0 : (op < 0xd0 ? IDLE_FLAGS_Z : IDLE_FLAGS_C);
+				length = 3;
+				jump = true;
+				break;
+			default:
+				if (op >= 0x40 && op < 0x80 && op != 0x76 && (op & 0x38) != 0x30) {
+					// LD r, r / LD r, (HL)
+					reads = idleLoopRegRead(idleLoop, op & 7);
+					writes = idleRegBits[(op >> 3) & 7];
+				} else if (op >= 0xa0 && op < 0xc0) {
+					// AND r / XOR r / OR r / CP r
+					reads = IDLE_REG_A | idleLoopRegRead(idleLoop, op & 7);
+					writes = (op < 0xb8 ? IDLE_REG_A : 0) | IDLE_FLAGS_Z | IDLE_FLAGS_C;
+				} else {
+					return false;
+				}
+				break;
+		}
+
+		readFirst |= reads & ~written;
+		written |= writes;
+		i += length;
+
+		if (jump) {
+			// registers read before they are set can't change or each iteration would be different
+			return i == size && !(readFirst & written);
+		}
+	}
+
+	return false;
+}
+
+// DIV and TIMA count on their own and the RTC registers follow the real time clock
+static bool idleLoopReadOk(unsigned int address) {
+	return address != 0xFF04 && address != 0xFF05 && !(address >= 0xA000 && address < 0xC000 && mbcIsRTC());
+}
+
+void cpuIdleLoopJump(unsigned int end) {
+	const unsigned int start = cpu.registers.pc;
+
+	if (cpuIdleLoopPC != start) {
+		// first time around since the last event, the loop may have been entered part way through
+		cpuIdleLoopPC = start;
+		idleLoopClocks = cpu.clocks;
+		return;
+	}
+
+	// the whole loop just ran once, so this is how long an iteration takes
+	const unsigned int loopClocks = cpu.clocks - idleLoopClocks;
+	idleLoopClocks = cpu.clocks;
+
+	// the loop has to stay within one page to be checked from the host copy
+	if ((start >> 8) != ((end - 1) >> 8)) {
+		cpuIdleLoopRejected = start;
+		return;
+	}
+
+	const unsigned char* code = getInstrByte(start);
+	const unsigned int size = end - start;
+	cpu_idleloop& idleLoop = idleLoops[start & (IDLE_LOOP_CACHE - 1)];
+	if (code != idleLoop.code || size != idleLoop.size || (idleLoop.idle && memcmp(code, idleLoop.bytes, size))) {
+		idleLoop.code = code;
+		idleLoop.size = size;
+		memcpy(idleLoop.bytes, code, size);
+		idleLoop.idle = idleLoopScan(idleLoop, code, size, start);
+		if (idleLoop.idle) {
+			cpuIdleStats.loopsFound++;
+		}
+	}
+
+	if (!idleLoop.idle || !loopClocks) {
+		cpuIdleLoopRejected = start;
+		return;
+	}
+
+	// the loop reads the same values up to the next event
+	unsigned int untilClock = eventNextClock;
+
+	for (unsigned int r = 0; r < idleLoop.numReads; r++) {
+		unsigned int address;
+		switch (idleLoop.readType[r]) {
+			case IDLE_READ_C: address = 0xFF00 | cpu.registers.c; break;
+			case IDLE_READ_BC: address = cpu.registers.bc; break;
+			case IDLE_READ_DE: address = cpu.registers.de; break;
+			case IDLE_READ_HL: address = cpu.registers.hl; break;
+			default: address = idleLoop.readAddress[r]; break;
+		}
+		if (!idleLoopReadOk(address)) {
+			cpuIdleLoopRejected = start;
+			return;
+		}
+
+#if LAZY_STAT
+		// or for STAT, up to the next mode change, which has no event during fast lines. This has to be from the start
+		// of the iteration that just ran, the mode may have changed after it was read
+		if (address == 0xFF41) {
+			untilClock = min(untilClock, gpuNextModeClock(cpu.clocks - loopClocks));
+		}
+#endif
+	}
+
+	// skip whole iterations as long as the jump that ends the last one (up to 12 clocks of it are added after this) is
+	// still done before the next event, so the cpu stops on the same instruction as it would have
+	const unsigned int jumpClocks = 12;
+	if (cpu.clocks + jumpClocks >= untilClock)
+		return;
+
+	const unsigned int iterations = (untilClock - cpu.clocks - jumpClocks - 1) / loopClocks;
+	if (iterations) {
+		cpu.clocks += iterations * loopClocks;
+		idleLoopClocks = cpu.clocks;
+
+		cpuIdleStats.cyclesSkipped += iterations * loopClocks;
+		cpuIdleStats.fastForwards++;
+	}
+}
+#endif
 
 void cpuReset(void) {
 	memset(sram, 0, sizeof(sram));
 	memcpy(&cpu.memory, ioReset, sizeof(cpu.memory));
 	memset(oam, 0, sizeof(oam));
+	oamChanged();
 	memset(wram_perm, 0, sizeof(wram_perm));
 	memset(wram_gb, 0, sizeof(wram_gb));
 	
 	cpu.registers.a = 0x01;
-	cpu.registers.f = 0xb0;
+	FLAGS_WRITE(0xb0);
 	cpu.registers.b = 0x00;
 	cpu.registers.c = 0x13;
 	cpu.registers.d = 0x00;
@@ -123,6 +378,18 @@ void cpuReset(void) {
 
 	// LCD starts out on
 	gpuStep = stepLCDOn_OAM;
+
+	eventReset();
+	cpuBlockFlush();
+
+#if IDLE_LOOP_SKIP
+	// stats are per ROM
+	memset(&cpuIdleStats, 0, sizeof(cpuIdleStats));
+	cpuIdleLoopRejected = 0xFFFFFFFF;
+	for (int i = 0; i < IDLE_LOOP_CACHE; i++) {
+		idleLoops[i].code = NULL;
+	}
+#endif
 }
 
 inline void undefined(void) {
@@ -154,15 +421,73 @@ inline void undefined(void) {
 
 void cb_n(unsigned int instruction);
 
+#if LAZY_FLAGS
+cpu_flagstate cpuFlagState = { FLAGOP_NONE };
+
+void cpuResolveFlags() {
+	const unsigned int result = cpuFlagState.result;
+	const unsigned int zero = ((result & 0xff) == 0) << FLAGS_Z_BIT;
+
+	switch (cpuFlagState.op) {
+		case FLAGOP_INC:
+			cpu.registers.f = zero | (((result & 0x0f) == 0) << FLAGS_HC_BIT) | (cpuFlagState.keep & FLAGS_C);
+			break;
+		case FLAGOP_DEC:
+			cpu.registers.f = zero | FLAGS_N | (((result & 0x0f) == 0x0f) << FLAGS_HC_BIT) | (cpuFlagState.keep & FLAGS_C);
+			break;
+		case FLAGOP_ADD:
+			cpu.registers.f =
+				zero |
+				((((cpuFlagState.a & 0x0f) + (cpuFlagState.b & 0x0f) + cpuFlagState.carry) & 0x10) << (FLAGS_HC_BIT - 4)) |
+				((result & 0x100) >> (8 - FLAGS_C_BIT));
+			break;
+		case FLAGOP_SUB:
+			cpu.registers.f =
+				zero |
+				FLAGS_N |
+				(((cpuFlagState.b & 0x0f) + cpuFlagState.carry > (cpuFlagState.a & 0x0f)) << FLAGS_HC_BIT) |
+				((result & 0x100) >> (8 - FLAGS_C_BIT));
+			break;
+		case FLAGOP_AND:
+			cpu.registers.f = zero | FLAGS_HC;
+			break;
+		case FLAGOP_LOGIC:
+			cpu.registers.f = zero;
+			break;
+		case FLAGOP_ADD16:
+			cpu.registers.f =
+				(cpuFlagState.keep & FLAGS_Z) |
+				(((((cpuFlagState.a & 0x0fff) + (cpuFlagState.b & 0x0fff)) & 0x1000) != 0) << FLAGS_HC_BIT) |
+				(((result & 0xffff0000) != 0) << FLAGS_C_BIT);
+			break;
+		case FLAGOP_SHIFT:
+			cpu.registers.f = zero | (cpuFlagState.keep & FLAGS_C);
+			break;
+		case FLAGOP_ROTA:
+			cpu.registers.f = cpuFlagState.keep & FLAGS_C;
+			break;
+		case FLAGOP_BIT:
+			cpu.registers.f = zero | FLAGS_HC | (cpuFlagState.keep & FLAGS_C);
+			break;
+	}
+
+	cpuFlagState.op = FLAGOP_NONE;
+}
+#endif
+
 inline unsigned char inc(unsigned char value) {
 	value++;
 		
 	// carry is ignored!
+#if LAZY_FLAGS
+	FLAGS_LAZY(FLAGOP_INC, 0, 0, 0, value, FLAGS_ISCARRY);
+#else
 	cpu.registers.f =
 		((value == 0) << FLAGS_Z_BIT) |															// ZERO
 		0 |																						// NEGATIVE
 		(((value & 0x0f) == 0) << FLAGS_HC_BIT) |												// HALF-CARRY
 		(FLAGS_ISCARRY);																		// CARRY
+#endif
 	
 	return value;
 }
@@ -171,11 +496,15 @@ inline unsigned char dec(unsigned char value) {
 	value--;
 
 	// carry is ignored!
+#if LAZY_FLAGS
+	FLAGS_LAZY(FLAGOP_DEC, 0, 0, 0, value, FLAGS_ISCARRY);
+#else
 	cpu.registers.f =
 		((value == 0) << FLAGS_Z_BIT) |															// ZERO
 		FLAGS_N |																				// NEGATIVE
 		(((value & 0x0f) == 0x0f) << FLAGS_HC_BIT) |											// HALF-CARRY
 		(FLAGS_ISCARRY);																		// CARRY
+#endif
 	
 	return value;
 }
@@ -183,11 +512,15 @@ inline unsigned char dec(unsigned char value) {
 static inline void add(unsigned char *destination, unsigned char value) {
 	unsigned int result = *destination + value;
 	
+#if LAZY_FLAGS
+	FLAGS_LAZY(FLAGOP_ADD, *destination, value, 0, result, 0);
+#else
 	cpu.registers.f =
 		(((result & 0xff) == 0) << FLAGS_Z_BIT) |												// ZERO
 		0 |																						// NEGATIVE
 		((((*destination & 0x0f) + (value & 0x0f)) & 0x10) << (FLAGS_HC_BIT - 4)) |					// HALF-CARRY
 		(((result & 0xff00) != 0) << FLAGS_C_BIT);												// CARRY
+#endif
 
 	*destination = (unsigned char)(result & 0xff);
 }
@@ -196,21 +529,29 @@ static inline void add2(unsigned int *destination, unsigned short value) {
 	unsigned int result = *destination + value;
 
 	// zero flag left alone
+#if LAZY_FLAGS
+	FLAGS_LAZY(FLAGOP_ADD16, *destination, value, 0, result, FLAGS_ISZERO);
+#else
 	cpu.registers.f =
 		(FLAGS_ISZERO) |																		// ZERO
 		0 |																						// NEGATIVE
 		(((((*destination & 0x0fff) + (value & 0x0fff)) & 0x1000) != 0) << FLAGS_HC_BIT) |		// HALF-CARRY
 		(((result & 0xffff0000) != 0) << FLAGS_C_BIT);											// CARRY
+#endif
 
 	*destination = (result & 0xffff);
 }
 
 static inline void sub(unsigned char value) {
+#if LAZY_FLAGS
+	FLAGS_LAZY(FLAGOP_SUB, cpu.registers.a, value, 0, cpu.registers.a - value, 0);
+#else
 	cpu.registers.f =
 		((cpu.registers.a == value) << FLAGS_Z_BIT) |						// ZERO
 		FLAGS_N |															// NEGATIVE
 		(((value & 0x0f) > (cpu.registers.a & 0x0f)) << FLAGS_HC_BIT) |		// HALF-CARRY
 		((value > cpu.registers.a) << FLAGS_C_BIT);							// CARRY
+#endif
 
 	cpu.registers.a -= value;
 }
@@ -240,11 +581,15 @@ inline void ld_b_n(unsigned char operand) { cpu.registers.b = operand; }
 inline void rlca(void) {
 	cpu.registers.a = (cpu.registers.a << 1) | (cpu.registers.a >> 7);
 
+#if LAZY_FLAGS
+	FLAGS_LAZY(FLAGOP_ROTA, 0, 0, 0, 0, (cpu.registers.a & 0x01) << FLAGS_C_BIT);
+#else
 	cpu.registers.f =
 		0 |																	// ZERO
 		0 |																	// NEGATIVE
 		0 |																	// HALF-CARRY
 		((cpu.registers.a & 0x01) << FLAGS_C_BIT);							// CARRY
+#endif
 }
 
 // 0x08
@@ -272,11 +617,15 @@ inline void ld_c_n(unsigned char operand) { cpu.registers.c = operand; }
 inline void rrca(void) {
 	cpu.registers.a = (cpu.registers.a >> 1) | (cpu.registers.a << 7);
 
+#if LAZY_FLAGS
+	FLAGS_LAZY(FLAGOP_ROTA, 0, 0, 0, 0, (cpu.registers.a & 0x80) >> (7 - FLAGS_C_BIT));
+#else
 	cpu.registers.f =
 		0 |																	// ZERO
 		0 |																	// NEGATIVE
 		0 |																	// HALF-CARRY
 		((cpu.registers.a & 0x80) >> (7 - FLAGS_C_BIT));					// CARRY
+#endif
 }
 
 // 0x10
@@ -311,11 +660,15 @@ inline void ld_d_n(unsigned char operand) { cpu.registers.d = operand; }
 inline void rla(void) {
 	int carry = FLAGS_ISCARRY ? 1 : 0;
 
+#if LAZY_FLAGS
+	FLAGS_LAZY(FLAGOP_ROTA, 0, 0, 0, 0, (cpu.registers.a & 0x80) >> (7 - FLAGS_C_BIT));
+#else
 	cpu.registers.f =
 		0 |																	// ZERO
 		0 |																	// NEGATIVE
 		0 |																	// HALF-CARRY
 		((cpu.registers.a & 0x80) >> (7 - FLAGS_C_BIT));					// CARRY
+#endif
 	
 	cpu.registers.a <<= 1;
 	cpu.registers.a += carry;
@@ -324,6 +677,7 @@ inline void rla(void) {
 // 0x18
 inline void jr_n(unsigned char operand) {
 	cpu.registers.pc += (signed char)operand;
+	IDLE_LOOP_JUMP(cpu.registers.pc - (signed char)operand);
 }
 
 // 0x19
@@ -348,11 +702,15 @@ inline void ld_e_n(unsigned char operand) { cpu.registers.e = operand; }
 inline void rra(void) {
 	int carry = (FLAGS_ISCARRY ? 1 : 0) << 7;
 
+#if LAZY_FLAGS
+	FLAGS_LAZY(FLAGOP_ROTA, 0, 0, 0, 0, (cpu.registers.a & 0x01) << FLAGS_C_BIT);
+#else
 	cpu.registers.f =
 		0 |																	// ZERO
 		0 |																	// NEGATIVE
 		0 |																	// HALF-CARRY
 		((cpu.registers.a & 0x01) << FLAGS_C_BIT);							// CARRY
+#endif
 	
 	cpu.registers.a >>= 1;
 	cpu.registers.a += carry;
@@ -364,6 +722,7 @@ inline void jr_nz_n(unsigned char operand) {
 	else {
 		cpu.registers.pc += (signed char)operand;
 		cpu.clocks += 8;
+		IDLE_LOOP_JUMP(cpu.registers.pc - (signed char)operand);
 	}
 }
 
@@ -428,6 +787,7 @@ inline void jr_z_n(unsigned char operand) {
 	if(FLAGS_ISZERO) {
 		cpu.registers.pc += (signed char)operand;
 		cpu.clocks += 8;
+		IDLE_LOOP_JUMP(cpu.registers.pc - (signed char)operand);
 	}
 	else cpu.clocks += 4;
 }
@@ -459,6 +819,7 @@ inline void jr_nc_n(char operand) {
 	else {
 		cpu.registers.pc += operand;
 		cpu.clocks += 12;
+		IDLE_LOOP_JUMP(cpu.registers.pc - operand);
 	}
 }
 
@@ -483,11 +844,11 @@ inline void ld_hlp_n(unsigned char operand) { writeByte(cpu.registers.hl, operan
 // 0x37
 inline void scf(void) { 
 	// set carry flag
-	cpu.registers.f =
+	FLAGS_WRITE(
 		(FLAGS_ISZERO) |							// ZERO
 		0 |											// NEGATIVE
 		0 |											// HALF-CARRY
-		(1 << FLAGS_C_BIT);							// CARRY
+		(1 << FLAGS_C_BIT));							// CARRY
 }
 
 // 0x38
@@ -495,6 +856,7 @@ inline void jr_c_n(char operand) {
 	if(FLAGS_ISCARRY) {
 		cpu.registers.pc += operand;
 		cpu.clocks += 8;
+		IDLE_LOOP_JUMP(cpu.registers.pc - operand);
 	}
 	else cpu.clocks += 4;
 }
@@ -520,11 +882,11 @@ inline void ld_a_n(unsigned char operand) { cpu.registers.a = operand; }
 // 0x3f
 inline void ccf(void) {
 	// complement carry flag
-	cpu.registers.f =
+	FLAGS_WRITE(
 		(FLAGS_ISZERO) |							// ZERO
 		0 |											// NEGATIVE
 		0 |											// HALF-CARRY
-		((FLAGS_ISCARRY == 0) << FLAGS_C_BIT);		// CARRY
+		((FLAGS_ISCARRY == 0) << FLAGS_C_BIT));		// CARRY
 }
 
 // 0x40-0x47 (except 0x46)
@@ -585,6 +947,12 @@ inline void add_a_hlp(void) { add(&cpu.registers.a, readByte(cpu.registers.hl));
 
 // 0x88-0x8f (except 0x8e)
 inline void adc(unsigned char value) {
+#if LAZY_FLAGS
+	unsigned int carry = FLAGS_ISCARRY ? 1 : 0;
+	int result = cpu.registers.a + value + carry;
+
+	FLAGS_LAZY(FLAGOP_ADD, cpu.registers.a, value, carry, result, 0);
+#else
 	int result = cpu.registers.a + value + (FLAGS_ISCARRY ? 1 : 0);
 
 	cpu.registers.f =
@@ -592,6 +960,7 @@ inline void adc(unsigned char value) {
 		0 |																									// NEGATIVE
 		((((value & 0x0f) + (cpu.registers.a & 0x0f) + (FLAGS_ISCARRY ? 1 : 0)) & 0x10) << (FLAGS_HC_BIT-4)) |	// HALF-CARRY
 		((result & 0x100) >> (8-FLAGS_C_BIT));																// CARRY
+#endif
 
 	cpu.registers.a = (unsigned char)(result & 0xff);
 }
@@ -626,6 +995,12 @@ inline void sub_a(void) { sub(cpu.registers.a); }
 
 // 0x98-0x9f (except 0x9e)
 inline void sbc(unsigned char value) {
+#if LAZY_FLAGS
+	unsigned int carry = FLAGS_ISCARRY ? 1 : 0;
+	int result = cpu.registers.a - value - carry;
+
+	FLAGS_LAZY(FLAGOP_SUB, cpu.registers.a, value, carry, result, 0);
+#else
 	int result = cpu.registers.a - value - (FLAGS_ISCARRY ? 1 : 0);
 
 	cpu.registers.f =
@@ -633,6 +1008,7 @@ inline void sbc(unsigned char value) {
 		FLAGS_N |																						// NEGATIVE
 		(((value & 0x0f) + (FLAGS_ISCARRY ? 1 : 0) > (cpu.registers.a & 0x0f)) << FLAGS_HC_BIT) |		// HALF-CARRY
 		((result & 0x100) >> (8-FLAGS_C_BIT));															// CARRY
+#endif
 
 	cpu.registers.a = (unsigned char)(result & 0xff);
 
@@ -645,11 +1021,15 @@ inline void sbc_hlp(void) { sbc(readByte(cpu.registers.hl)); }
 inline void and_op(unsigned char value) {
 	cpu.registers.a &= value;
 
+#if LAZY_FLAGS
+	FLAGS_LAZY(FLAGOP_AND, 0, 0, 0, cpu.registers.a, 0);
+#else
 	cpu.registers.f =
 		((cpu.registers.a == 0) << FLAGS_Z_BIT) |							// ZERO
 		0 |																	// NEGATIVE
 		FLAGS_HC |															// HALF-CARRY
 		0;																	// CARRY
+#endif
 }
 
 // 0xa6
@@ -659,11 +1039,15 @@ inline void and_hlp(void) { and_op(readByte(cpu.registers.hl)); }
 inline void xor_op(unsigned char value) {
 	cpu.registers.a ^= value;
 
+#if LAZY_FLAGS
+	FLAGS_LAZY(FLAGOP_LOGIC, 0, 0, 0, cpu.registers.a, 0);
+#else
 	cpu.registers.f =
 		((cpu.registers.a == 0) << FLAGS_Z_BIT) |							// ZERO
 		0 |																	// NEGATIVE
 		0 |																	// HALF-CARRY
 		0;																	// CARRY
+#endif
 }
 
 // 0xae
@@ -673,11 +1057,15 @@ inline void xor_hlp(void) { xor_op(readByte(cpu.registers.hl)); }
 inline void or_op(unsigned char value) {
 	cpu.registers.a |= value;
 
+#if LAZY_FLAGS
+	FLAGS_LAZY(FLAGOP_LOGIC, 0, 0, 0, cpu.registers.a, 0);
+#else
 	cpu.registers.f =
 		((cpu.registers.a == 0) << FLAGS_Z_BIT) |							// ZERO
 		0 |																	// NEGATIVE
 		0 |																	// HALF-CARRY
 		0;																	// CARRY
+#endif
 }
 
 // 0xb6
@@ -685,11 +1073,15 @@ inline void or_hlp(void) { or_op(readByte(cpu.registers.hl)); }
 
 // 0xb8-bf (except 0xbe)
 inline void cp(unsigned char value) {
+#if LAZY_FLAGS
+	FLAGS_LAZY(FLAGOP_SUB, cpu.registers.a, value, 0, cpu.registers.a - value, 0);
+#else
 	cpu.registers.f =
 		((cpu.registers.a == value) << FLAGS_Z_BIT) |						// ZERO
 		FLAGS_N |															// NEGATIVE
 		(((value & 0x0f) > (cpu.registers.a & 0x0f)) << FLAGS_HC_BIT) |		// HALF-CARRY
 		((value > cpu.registers.a) << 4);									// CARRY
+#endif
 }
 
 // 0xbe
@@ -711,14 +1103,18 @@ inline void pop_bc(void) { cpu.registers.bc = readShortFromStack(); }
 inline void jp_nz_nn(unsigned short operand) {
 	if(FLAGS_ISZERO) cpu.clocks += 8;
 	else {
+		const unsigned int end = cpu.registers.pc;
 		cpu.registers.pc = operand;
 		cpu.clocks += 12;
+		IDLE_LOOP_JUMP(end);
 	}
 }
 
 // 0xc3
 inline void jp_nn(unsigned short operand) {
+	const unsigned int end = cpu.registers.pc;
 	cpu.registers.pc = operand;
+	IDLE_LOOP_JUMP(end);
 }
 
 // 0xc4
@@ -755,8 +1151,10 @@ inline void ret(void) { cpu.registers.pc = readShortFromStack(); }
 // 0xca
 inline void jp_z_nn(unsigned short operand) {
 	if(FLAGS_ISZERO) {
+		const unsigned int end = cpu.registers.pc;
 		cpu.registers.pc = operand;
 		cpu.clocks += 12;
+		IDLE_LOOP_JUMP(end);
 	}
 	else cpu.clocks += 8;
 }
@@ -798,8 +1196,10 @@ inline void pop_de(void) { cpu.registers.de = readShortFromStack(); }
 // 0xd2
 inline void jp_nc_nn(unsigned short operand) {
 	if(!FLAGS_ISCARRY) {
+		const unsigned int end = cpu.registers.pc;
 		cpu.registers.pc = operand;
 		cpu.clocks += 12;
+		IDLE_LOOP_JUMP(end);
 	}
 	else cpu.clocks += 8;
 }
@@ -841,8 +1241,10 @@ inline void ret_i(void) {
 // 0xda
 inline void jp_c_nn(unsigned short operand) {
 	if(FLAGS_ISCARRY) {
+		const unsigned int end = cpu.registers.pc;
 		cpu.registers.pc = operand;
 		cpu.clocks += 12;
+		IDLE_LOOP_JUMP(end);
 	}
 	else cpu.clocks += 8;
 }
@@ -867,8 +1269,10 @@ inline void rst_18(void) { writeShortToStack(cpu.registers.pc); cpu.registers.pc
 inline void ld_ff_n_ap(unsigned char operand) {
 	if (specialMap[operand] & 0x02)
 		writeByteSpecial(operand, cpu.registers.a);
-	else
+	else {
 		cpu.memory.all[operand] = cpu.registers.a;
+		cpuPageTouched(0xff);
+	}
 }
 
 // 0xe1
@@ -878,8 +1282,10 @@ inline void pop_hl(void) { cpu.registers.hl = readShortFromStack(); }
 inline void ld_ff_c_a(void) {
 	if (specialMap[cpu.registers.c] & 0x02)
 		writeByteSpecial(cpu.registers.c, cpu.registers.a);
-	else
+	else {
 		cpu.memory.all[cpu.registers.c] = cpu.registers.a;
+		cpuPageTouched(0xff);
+	}
 }
 
 // 0xe5
@@ -893,11 +1299,11 @@ inline void add_sp_n(unsigned char operand) {
 	unsigned int result = cpu.registers.sp + operand;
 
 	// _does_ clear the zero flag
-	cpu.registers.f =
+	FLAGS_WRITE(
 		0 |																						// ZERO
 		0 |																						// NEGATIVE
 		(((cpu.registers.sp & 0x000f) + (operand & 0x0f) > 0x0f) << FLAGS_HC_BIT) |				// HALF-CARRY
-		(((result & 0xff00) != (cpu.registers.sp & 0xff00)) << FLAGS_C_BIT);					// CARRY
+		(((result & 0xff00) != (cpu.registers.sp & 0xff00)) << FLAGS_C_BIT));					// CARRY
 
 	// signed result
 	if (operand & 0x80) {
@@ -927,7 +1333,7 @@ inline void ld_ff_ap_n(unsigned char operand) {
 }
 
 // 0xf1
-inline void pop_af(void) { cpu.registers.af = readShortFromStack(); cpu.registers.f &= 0xF0; }
+inline void pop_af(void) { cpu.registers.af = readShortFromStack(); FLAGS_WRITE(cpu.registers.f & 0xF0); }
 
 // 0xf2
 inline void ld_a_ff_c(void) {
@@ -938,7 +1344,7 @@ inline void ld_a_ff_c(void) {
 inline void di_inst(void) { cpu.IME = 0; }
 
 // 0xf5
-inline void push_af(void) { writeShortToStack(cpu.registers.af); }
+inline void push_af(void) { cpuSyncFlags(); writeShortToStack(cpu.registers.af); }
 
 // 0xf6
 inline void or_n(unsigned char operand) { or_op(operand); }
@@ -950,11 +1356,11 @@ inline void rst_30(void) { writeShortToStack(cpu.registers.pc); cpu.registers.pc
 void ld_hl_sp_n(unsigned char operand) {
 	int result = cpu.registers.sp + operand;
 
-	cpu.registers.f =
+	FLAGS_WRITE(
 		0 |																						// ZERO
 		0 |																						// NEGATIVE
 		(((cpu.registers.sp & 0x000f) + (operand & 0x0f) > 0x0f) << FLAGS_HC_BIT) |				// HALF-CARRY
-		(((result & 0xff00) != (cpu.registers.sp & 0xff00)) << FLAGS_C_BIT);					// CARRY
+		(((result & 0xff00) != (cpu.registers.sp & 0xff00)) << FLAGS_C_BIT));					// CARRY
 
 	// signed result
 	if (operand & 0x80) {
@@ -1003,46 +1409,386 @@ static const char* regNames[8] = {
 };
 #endif
 
-#define INSTRUCTION_0(name,numticks,func,id,code)   case id: DebugInstruction(name); func(); cpu.clocks += (numticks - 4); code break;
-#define INSTRUCTION_1(name,numticks,func,id,code)   case id: DebugInstruction(name, pc[1]); { cpu.registers.pc += 1; func(pc[1]); cpu.clocks += (numticks - 4); code } break;
-#define INSTRUCTION_1S(name,numticks,func,id,code)  case id: DebugInstruction(name, pc[1]); { cpu.registers.pc += 1; func((signed char) pc[1]); cpu.clocks += (numticks - 4); code } break;
-#define INSTRUCTION_2(name,numticks,func,id,code)   case id: DebugInstruction(name, pc[1] | (pc[2] << 8)); { cpu.registers.pc += 2; func(pc[1] | (pc[2] << 8)); cpu.clocks += (numticks - 4); code } break;
-#define INSTRUCTION_L(name,numticks,func,id,code)   case id: 
-#define INSTRUCTION_E(name,numticks,func,id,code)   case id: DebugInstructionMapped(name, regNames[pc[0] & 7]); func(*regMap[pc[0] & 7]); cpu.clocks += (numticks - 4); code break;
-#define CB_INSTRUCTION(name,numticks,func,id,code)  case id: DebugInstruction(name); func(); cpu.clocks += (numticks - 4); code break;
-#define CB_INSTR______(name,numticks,func,id,code)  case id: 
-#define CB_INSTRMAPPED(name,numticks,func,id,code)  case id: DebugInstructionMapped(name, regNames[operand & 7]); func(*regMap[operand & 7]); cpu.clocks += (numticks - 4); code break;
+#define LEAVE_LOOP eventInterruptChanged();
 
-#define LEAVE_LOOP {cpu.clocks -= (numInstr - i - 1) * 4; i = numInstr;}
+#if !BLOCK_CACHE
+void cpuBlockFlush() {
+}
+#endif
 
-void cb_n(int operand);
+#if THREADED_DISPATCH
+
+// Threaded dispatch: each opcode handler is a label (op_0x00, cb_0x00, etc) that ends by fetching and jumping to the
+// next handler itself, so each opcode gets its own indirect branch for the host branch predictor
+static void* opHandlers[256] = { 0 };
+static void* cbHandlers[256] = { 0 };
+
+#if BLOCK_CACHE
+
+// Basic block cache: runs of instructions up to the next branch are decoded once (handler address and operands) so
+// dispatch no longer has to go through the memory map or the opcode tables for each instruction. Blocks are keyed
+// on their host address and carry the generation counter that covers their bytes, so they decode again when a RAM
+// page is written or a cached ROM bank slot is reloaded with a different bank.
+//
+// Note: writes through the echo area (0xE000-0xFDFF) only touch the echo page's generation, so code in WRAM that is
+// modified through the echo area is not seen. No known game relies on this.
+
+#define MAX_BLOCK_INSTRS 16
+#define NUM_BLOCKS 4096
+
+struct cpu_blockinstr {
+	void* handler;
+	unsigned short imm16;
+	unsigned char opcode;
+	unsigned char imm8;				// first operand byte, or the extended opcode for 0xcb
+};
+
+struct cpu_block {
+	const unsigned char* start;		// host address of the first instruction, NULL if this block is not cached
+	const unsigned int* validGen;	// generation counter covering the block's bytes
+	unsigned int validGenValue;
+	unsigned char page;
+	unsigned char numInstrs;
+#if CPU_JIT
+	unsigned char jitHeat;			// number of times entered before being translated
+	unsigned int pc;				// address of the first instruction
+	void* jitCode;					// translated code, NULL if not translated yet
+	cpu_block* jitLink[2];			// successors the translated code can jump straight to
+	unsigned int jitClocks;			// clocks before the last instruction starts, the block only runs natively if they fit before the next event
+#endif
+	cpu_blockinstr instrs[MAX_BLOCK_INSTRS];
+};
+
+unsigned int cpuPageGeneration[256] = { 0 };
+
+static cpu_block blockCache[NUM_BLOCKS];
+static cpu_block uncachedBlock;
+
+// instruction byte lengths and which instructions end a block (branches, and anything that leaves the batch loop)
+static unsigned char opLength[256];
+static bool opEndsBlock[256];
+
+static const unsigned char blockEndOps[] = {
+	0x18, 0x20, 0x28, 0x30, 0x38,					// JR
+	0xc2, 0xc3, 0xca, 0xd2, 0xda, 0xe9,				// JP
+	0xc4, 0xcc, 0xcd, 0xd4, 0xdc,					// CALL
+	0xc0, 0xc8, 0xc9, 0xd0, 0xd8, 0xd9,				// RET, RETI
+	0xc7, 0xcf, 0xd7, 0xdf, 0xe7, 0xef, 0xf7, 0xff,	// RST
+	0x10, 0x76, 0xfb								// STOP, HALT, EI
+};
+
+inline unsigned int blockHash(const unsigned char* host) {
+	const unsigned int addr = (unsigned int) (size_t) host;
+	return (addr ^ (addr >> 12)) & (NUM_BLOCKS - 1);
+}
+
+#if CPU_JIT
+#include "cpu_jit_x64.inl"
+#endif
+
+void cpuBlockFlush() {
+	for (int i = 0; i < NUM_BLOCKS; i++) {
+		blockCache[i].start = NULL;
+	}
+#if CPU_JIT
+	cpuJitResetCode();
+#endif
+}
+
+// decodes the block starting at the given address (whose memory is at host)
+static cpu_block* cpuBlockDecode(unsigned int address, const unsigned char* host) {
+	const unsigned int page = address >> 8;
+
+	// instructions may not start at or past limit, and when end is set their bytes may not pass it either
+	const unsigned char* limit = host + 1;
+	const unsigned char* end = NULL;
+	const unsigned int* validGen = NULL;
+
+	bool romPage = false;
+	if (page < 0x40) {
+		// bank 0 is always mapped
+		limit = host + (0x4000 - address);
+		validGen = &cpuPageGeneration[page];
+		romPage = true;
+	} else if (page < 0x80) {
+		// switchable ROM, valid as long as the cached bank slot holds the same bank (the slots overlap by 2 bytes so
+		// the last instruction can straddle the end)
+		for (unsigned int s = 0; s < numCachedBanks; s++) {
+			const unsigned char* bank = cachedBanks[s]->bank;
+			if (host >= bank && host < bank + 0x1000) {
+				limit = bank + 0x1000;
+				validGen = &cachedBankGeneration[s];
+				romPage = true;
+				break;
+			}
+		}
+#if ROM_ZERO_COPY
+		// or mapped straight from the file, valid until the block addresses are looked up again. The shadow copy of
+		// a block's last page is refilled on every bank switch so it is handled like RAM
+		if (!romPage && !mbcIsRomShadow(host)) {
+			limit = host + (0x1000 - (address & 0xFFF));
+			validGen = &romMapGeneration;
+			romPage = true;
+		}
+#endif
+	}
+
+	if (!romPage) {
+		// RAM, each page is tracked seperately so stay within this one
+		limit = end = host + (0x100 - (address & 0xFF));
+		validGen = &cpuPageGeneration[page];
+
+		if (host + opLength[host[0]] > end) {
+			// first instruction straddles the page, run it by itself
+			limit = host + 1;
+			end = NULL;
+			validGen = NULL;
+		}
+	}
+
+	cpu_block* block = validGen ? &blockCache[blockHash(host)] : &uncachedBlock;
+	const unsigned char* p = host;
+	int numInstrs = 0;
+	do {
+		const unsigned char op = p[0];
+		const unsigned int length = opLength[op];
+		if (end && p + length > end) {
+			break;
+		}
+
+		cpu_blockinstr& instr = block->instrs[numInstrs++];
+		instr.opcode = op;
+		instr.imm8 = length > 1 ? p[1] : 0;
+		instr.imm16 = length > 2 ? (p[1] | (p[2] << 8)) : instr.imm8;
+		instr.handler = op == 0xcb ? cbHandlers[p[1]] : opHandlers[op];
+
+		p += length;
+		if (opEndsBlock[op]) {
+			break;
+		}
+	} while (numInstrs < MAX_BLOCK_INSTRS && p < limit);
+
+	block->start = validGen ? host : NULL;
+	block->validGen = validGen;
+	block->validGenValue = validGen ? *validGen : 0;
+	block->page = page;
+	block->numInstrs = numInstrs;
+#if CPU_JIT
+	block->jitHeat = 0;
+	block->pc = address;
+	block->jitCode = NULL;
+	block->jitLink[0] = NULL;
+	block->jitLink[1] = NULL;
+#endif
+
+	return block;
+}
+
+#define OPCODE ins->opcode
+#define IMM8 ins->imm8
+#define IMM16 ins->imm16
+
+// blocks also end early when the page they run from is touched (bank switch, self modifying code, etc)
+#define DISPATCH_NEXT { ins++; if (cpu.clocks >= eventNextClock) goto batchDone; if (ins == insEnd || *runGen != runGenValue) goto blockLookup; DebugPC(cpu.registers.pc); cpu.registers.pc++; goto *ins->handler; }
+
+#else
+
+#define OPCODE pc[0]
+#define IMM8 pc[1]
+#define IMM16 (pc[1] | (pc[2] << 8))
+
+#define DISPATCH_NEXT { if (cpu.clocks >= eventNextClock) goto batchDone; DebugPC(cpu.registers.pc); pc = getInstrByte(cpu.registers.pc++); goto *opHandlers[pc[0]]; }
+
+#endif
+
+#if BLOCK_CACHE
+#define SET_OP_LENGTH(id,length) opLength[id] = length;
+#else
+#define SET_OP_LENGTH(id,length)
+#endif
 
 void cpuStep() {
+	if (opHandlers[0] == 0) {
+		// build the handler tables from the same instruction lists
+		for (int op = 0; op < 256; op++) {
+			opHandlers[op] = &&op_undefined;
+			SET_OP_LENGTH(op, 1);
+		}
+		opHandlers[0xcb] = &&op_cb;
+		SET_OP_LENGTH(0xcb, 2);
+
+		#define INSTRUCTION_0(name,numticks,func,id,code)   opHandlers[id] = &&op_##id;
+		#define INSTRUCTION_1(name,numticks,func,id,code)   opHandlers[id] = &&op_##id; SET_OP_LENGTH(id, 2);
+		#define INSTRUCTION_1S(name,numticks,func,id,code)  opHandlers[id] = &&op_##id; SET_OP_LENGTH(id, 2);
+		#define INSTRUCTION_2(name,numticks,func,id,code)   opHandlers[id] = &&op_##id; SET_OP_LENGTH(id, 3);
+		#define INSTRUCTION_L(name,numticks,func,id,code)   opHandlers[id] = &&op_##id;
+		#define INSTRUCTION_E(name,numticks,func,id,code)   opHandlers[id] = &&op_##id;
+		#define CB_INSTRUCTION(name,numticks,func,id,code)  cbHandlers[id] = &&cb_##id;
+		#define CB_INSTR______(name,numticks,func,id,code)  cbHandlers[id] = &&cb_##id;
+		#define CB_INSTRMAPPED(name,numticks,func,id,code)  cbHandlers[id] = &&cb_##id;
+		#include "cpu_instructions.inl"
+		#include "cb_instructions.inl"
+		#undef INSTRUCTION_0
+		#undef INSTRUCTION_1
+		#undef INSTRUCTION_1S
+		#undef INSTRUCTION_2
+		#undef INSTRUCTION_L
+		#undef INSTRUCTION_E
+		#undef CB_INSTRUCTION
+		#undef CB_INSTR______
+		#undef CB_INSTRMAPPED
+
+#if BLOCK_CACHE
+		for (int op = 0; op < 256; op++) {
+			opEndsBlock[op] = opHandlers[op] == &&op_undefined;
+		}
+		for (unsigned int e = 0; e < sizeof(blockEndOps); e++) {
+			opEndsBlock[blockEndOps[e]] = true;
+		}
+#endif
+	}
+
+#if BLOCK_CACHE
+	// current position in a decoded block, kept across batches so a block can pick up where the last batch stopped
+	const cpu_blockinstr* ins = NULL;
+	const cpu_blockinstr* insEnd = NULL;
+	const unsigned int* runGen = NULL;
+	unsigned int runGenValue = 0;
+	unsigned int resumePC = 0;
+	const unsigned char* host;
+	cpu_block* block;
+#endif
+
 	{
 		TIME_SCOPE();
 
 		for (int b = 0; b < BATCHES; b++) {
-			if (cpu.stopped || cpu.halted) {
-				// just advance the clock til something happens
-				unsigned int numClocks = max(cpu.gpuTick - cpu.clocks, 4);
-
-				if (cpu.memory.TAC_timerctl & 0x04) {
-					numClocks = min(cpu.timerInterrupt - cpu.clocks, numClocks);
+			if (cpu.clocks >= eventNextClock) {
+				// an interrupt or DMA already ran into the next event
+			} else if (cpu.stopped || cpu.halted) {
+				// nothing happens until the next event, so there is time to read ahead
+				mbcPrefetch();
+				cpu.clocks = eventNextClock;
+			} else {
+				// run instructions until the next event is due
+#if BLOCK_CACHE
+				if (ins != insEnd && cpu.registers.pc == resumePC && *runGen == runGenValue) {
+					DebugPC(cpu.registers.pc);
+					cpu.registers.pc++;
+					goto *ins->handler;
 				}
 
-				cpu.clocks += numClocks;
-			} else {
-				// 8 clocks per instruction is about the average from empirical testing
-				unsigned int numInstr = min(max(cpu.gpuTick - cpu.clocks, (MIN_CPU_BATCH * 8)) / 8, MAX_CPU_BATCH);
+				blockLookup:
+					DebugPC(cpu.registers.pc);
+					host = getInstrByte(cpu.registers.pc);
+					block = &blockCache[blockHash(host)];
+					if (block->start != host || block->page != ((cpu.registers.pc >> 8) & 0xFF) || *block->validGen != block->validGenValue) {
+						block = cpuBlockDecode(cpu.registers.pc & 0xFFFF, host);
+					}
+#if CPU_JIT
+					if (block->jitCode || (block->start && ++block->jitHeat >= JIT_HOT_COUNT && cpuJitTranslate(block))) {
+						// every instruction of the block has to start before the next event, like in the interpreter
+						if (cpu.clocks + block->jitClocks < eventNextClock) {
+							cpuJitRun(block, (cpu.registers.pc >> 8) & 0xFF);
+							ins = insEnd = NULL;
+							if (cpu.clocks >= eventNextClock) goto batchDone;
+							goto blockLookup;
+						}
+					}
+					jitFrom = NULL;
+#endif
+					ins = block->instrs;
+					insEnd = ins + block->numInstrs;
+					runGen = &cpuPageGeneration[(cpu.registers.pc >> 8) & 0xFF];
+					runGenValue = *runGen;
+					cpu.registers.pc++;
+					goto *ins->handler;
+#else
+				DebugPC(cpu.registers.pc);
+				unsigned char* pc = getInstrByte(cpu.registers.pc++);
+				goto *opHandlers[pc[0]];
+#endif
 
-				if (cpu.memory.TAC_timerctl & 0x04) {
-					numInstr = min(max(cpu.timerInterrupt - cpu.clocks, (MIN_CPU_BATCH * 8)) / 8, numInstr);
-				}
+				#define INSTRUCTION_0(name,numticks,func,id,code)   op_##id: DebugInstruction(name); func(); cpu.clocks += numticks; code DISPATCH_NEXT
+				#define INSTRUCTION_1(name,numticks,func,id,code)   op_##id: DebugInstruction(name, IMM8); { cpu.registers.pc += 1; func(IMM8); cpu.clocks += numticks; code } DISPATCH_NEXT
+				#define INSTRUCTION_1S(name,numticks,func,id,code)  op_##id: DebugInstruction(name, IMM8); { cpu.registers.pc += 1; func((signed char) IMM8); cpu.clocks += numticks; code } DISPATCH_NEXT
+				#define INSTRUCTION_2(name,numticks,func,id,code)   op_##id: DebugInstruction(name, IMM16); { cpu.registers.pc += 2; func(IMM16); cpu.clocks += numticks; code } DISPATCH_NEXT
+				#define INSTRUCTION_L(name,numticks,func,id,code)   op_##id: 
+				#define INSTRUCTION_E(name,numticks,func,id,code)   op_##id: DebugInstructionMapped(name, regNames[OPCODE & 7]); func(*regMap[OPCODE & 7]); cpu.clocks += numticks; code DISPATCH_NEXT
+				#define CB_INSTRUCTION(name,numticks,func,id,code)  cb_##id: cpu.registers.pc += 1; DebugInstruction(name); func(); cpu.clocks += numticks; code DISPATCH_NEXT
+				#define CB_INSTR______(name,numticks,func,id,code)  cb_##id: 
+				#define CB_INSTRMAPPED(name,numticks,func,id,code)  cb_##id: cpu.registers.pc += 1; DebugInstructionMapped(name, regNames[IMM8 & 7]); func(*regMap[IMM8 & 7]); cpu.clocks += numticks; code DISPATCH_NEXT
+
+				// main instruction set
+				#include "cpu_instructions.inl"
+
+				// extended instruction set, dispatched inline (blocks jump straight to the cb handler)
+				op_cb:
+					goto *cbHandlers[IMM8];
+				#include "cb_instructions.inl"
+
+				// unknown instruction
+				op_undefined:
+					undefined();
+					DISPATCH_NEXT
+
+				batchDone:;
+#if BLOCK_CACHE
+				resumePC = cpu.registers.pc;
+#endif
+#if CPU_JIT
+				jitFrom = NULL;
+#endif
+			}
 
-				// instructions start with a "base" of 4 clocks a piece
-				cpu.clocks += numInstr * 4;
+			eventDispatch();
+		}
 
-				for (unsigned int i = 0; i < numInstr; i++) {
+		// normalize cpu timer when it gets pretty high to prevent math errors
+		const unsigned int normalizeAmt = 1024 * 1024;
+		if (cpu.clocks > normalizeAmt * 2) {
+			updateTimer();
+			cpu.clocks -= normalizeAmt;
+			cpu.timerBase -= normalizeAmt;
+			if (cpu.timerInterrupt != 0xFFFFFFFF) cpu.timerInterrupt -= normalizeAmt;
+			cpu.gpuTick -= normalizeAmt;
+			eventRebase(normalizeAmt);
+		}
+	}
+}
+
+#undef OPCODE
+#undef IMM8
+#undef IMM16
+
+#else
+
+#define INSTRUCTION_0(name,numticks,func,id,code)   case id: DebugInstruction(name); func(); cpu.clocks += numticks; code break;
+#define INSTRUCTION_1(name,numticks,func,id,code)   case id: DebugInstruction(name, pc[1]); { cpu.registers.pc += 1; func(pc[1]); cpu.clocks += numticks; code } break;
+#define INSTRUCTION_1S(name,numticks,func,id,code)  case id: DebugInstruction(name, pc[1]); { cpu.registers.pc += 1; func((signed char) pc[1]); cpu.clocks += numticks; code } break;
+#define INSTRUCTION_2(name,numticks,func,id,code)   case id: DebugInstruction(name, pc[1] | (pc[2] << 8)); { cpu.registers.pc += 2; func(pc[1] | (pc[2] << 8)); cpu.clocks += numticks; code } break;
+#define INSTRUCTION_L(name,numticks,func,id,code)   case id: 
+#define INSTRUCTION_E(name,numticks,func,id,code)   case id: DebugInstructionMapped(name, regNames[pc[0] & 7]); func(*regMap[pc[0] & 7]); cpu.clocks += numticks; code break;
+#define CB_INSTRUCTION(name,numticks,func,id,code)  case id: DebugInstruction(name); func(); cpu.clocks += numticks; code break;
+#define CB_INSTR______(name,numticks,func,id,code)  case id: 
+#define CB_INSTRMAPPED(name,numticks,func,id,code)  case id: DebugInstructionMapped(name, regNames[operand & 7]); func(*regMap[operand & 7]); cpu.clocks += numticks; code break;
+
+void cb_n(int operand);
+
+void cpuStep() {
+	{
+		TIME_SCOPE();
+
+		for (int b = 0; b < BATCHES; b++) {
+			if (cpu.clocks >= eventNextClock) {
+				// an interrupt or DMA already ran into the next event
+			} else if (cpu.stopped || cpu.halted) {
+				// nothing happens until the next event, so there is time to read ahead
+				mbcPrefetch();
+				cpu.clocks = eventNextClock;
+			} else {
+				// run instructions until the next event is due
+				do {
 					DebugPC(cpu.registers.pc);
 					unsigned char* pc = getInstrByte(cpu.registers.pc++);
 					// perform inlined instruction op
@@ -1058,11 +1804,10 @@ void cpuStep() {
 							undefined();
 							break;
 					}
-				}
+				} while (cpu.clocks < eventNextClock);
 			}
 
-			if (gpuCheck()) gpuStep();
-			if (interruptCheck()) interruptStep();
+			eventDispatch();
 		}
 
 		// normalize cpu timer when it gets pretty high to prevent math errors
@@ -1073,6 +1818,7 @@ void cpuStep() {
 			cpu.timerBase -= normalizeAmt;
 			if (cpu.timerInterrupt != 0xFFFFFFFF) cpu.timerInterrupt -= normalizeAmt;
 			cpu.gpuTick -= normalizeAmt;
+			eventRebase(normalizeAmt);
 		}
 	}
 }
@@ -1090,4 +1836,6 @@ void cb_n(int operand) {
 #undef INSTRUCTION_2
 #undef INSTRUCTION_L
 #undef INSTRUCTION_E
-#undef CB_INSTRUCTION
\ No newline at end of file
+#undef CB_INSTRUCTION
+
+#endif
@@ -113,6 +113,54 @@ struct cpu_type {
 
 extern cpu_type cpu ALIGN(256);
 
+// instruction dispatch mode, threaded code (computed goto handler tables) is only available with GCC/Clang, otherwise
+// a single switch statement is used. Can be overridden by defining THREADED_DISPATCH as 0 or 1
+#ifndef THREADED_DISPATCH
+#ifdef __GNUC__
+#define THREADED_DISPATCH 1
+#else
+#define THREADED_DISPATCH 0
+#endif
+#endif
+
+// predecoded basic block cache, keeps ~1 MB of decoded blocks so it is only on by default for the host build
+#ifndef BLOCK_CACHE
+#if THREADED_DISPATCH && TARGET_LINUX
+#define BLOCK_CACHE 1
+#else
+#define BLOCK_CACHE 0
+#endif
+#endif
+
+#if BLOCK_CACHE && !THREADED_DISPATCH
+#error "BLOCK_CACHE requires THREADED_DISPATCH"
+#endif
+
+// x86-64 recompiler for hot blocks in the block cache, optional for host builds
+#ifndef CPU_JIT
+#define CPU_JIT 0
+#endif
+
+#if CPU_JIT && (!BLOCK_CACHE || !defined(__x86_64__) || !TARGET_LINUX)
+#error "CPU_JIT requires BLOCK_CACHE on an x86-64 Linux host"
+#endif
+
+#if BLOCK_CACHE
+// generation counter per 256 byte page, bumped whenever the page is written or remapped so that predecoded blocks
+// running from RAM (or a switched ROM bank) know to decode again
+extern unsigned int cpuPageGeneration[256];
+#endif
+
+// called when the given page is written to or has its memory map entry changed
+inline void cpuPageTouched(unsigned int page) {
+#if BLOCK_CACHE
+	cpuPageGeneration[page]++;
+#endif
+}
+
+// throws away all predecoded blocks (new ROM, loaded state, etc)
+void cpuBlockFlush();
+
 #define FLAGS_Z (1 << 7)
 #define FLAGS_Z_BIT 7
 #define FLAGS_N (1 << 6)
@@ -122,14 +170,129 @@ extern cpu_type cpu ALIGN(256);
 #define FLAGS_C (1 << 4)
 #define FLAGS_C_BIT 4
 
+// lazy flag evaluation, the common ALU ops only record their operands and result and the flags register is worked
+// out when something actually reads it (conditional branches only work out the one flag they test). Can be
+// overridden by defining LAZY_FLAGS as 0 or 1
+#ifndef LAZY_FLAGS
+#define LAZY_FLAGS 0
+#endif
+
+#if LAZY_FLAGS
+// the operation that last produced the flags
+enum cpu_flagop {
+	FLAGOP_NONE = 0,		// cpu.registers.f is up to date
+	FLAGOP_ADD,				// a + b + carry = result (ADD, ADC)
+	FLAGOP_SUB,				// a - b - carry = result (SUB, SBC, CP)
+	FLAGOP_INC,				// result, keep = previous carry
+	FLAGOP_DEC,				// result, keep = previous carry
+	FLAGOP_AND,				// result
+	FLAGOP_LOGIC,			// result (OR, XOR)
+	FLAGOP_ADD16,			// a + b = result, keep = previous zero
+	FLAGOP_SHIFT,			// result, keep = carry out (CB rotates, shifts and SWAP)
+	FLAGOP_ROTA,			// keep = carry out (RLCA, RRCA, RLA, RRA)
+	FLAGOP_BIT,				// result = tested bit, keep = previous carry
+};
+
+struct cpu_flagstate {
+	unsigned int op;
+	unsigned int a;
+	unsigned int b;
+	unsigned int carry;
+	unsigned int result;
+	unsigned int keep;		// flag bits already known when the op ran
+};
+
+extern cpu_flagstate cpuFlagState;
+
+// works out cpu.registers.f from the last flag op
+void cpuResolveFlags();
+
+inline void cpuSyncFlags() {
+	if (cpuFlagState.op != FLAGOP_NONE) cpuResolveFlags();
+}
+
+inline unsigned int cpuZeroFlag() {
+	switch (cpuFlagState.op) {
+		case FLAGOP_NONE: return cpu.registers.f & FLAGS_Z;
+		case FLAGOP_ROTA: return 0;
+		case FLAGOP_ADD16: return cpuFlagState.keep & FLAGS_Z;
+		default: return (cpuFlagState.result & 0xFF) ? 0 : FLAGS_Z;
+	}
+}
+
+inline unsigned int cpuCarryFlag() {
+	switch (cpuFlagState.op) {
+		case FLAGOP_NONE: return cpu.registers.f & FLAGS_C;
+		case FLAGOP_ADD:
+		case FLAGOP_SUB: return (cpuFlagState.result & 0x100) >> (8 - FLAGS_C_BIT);
+		case FLAGOP_AND:
+		case FLAGOP_LOGIC: return 0;
+		case FLAGOP_ADD16: return (cpuFlagState.result & 0xffff0000) ? FLAGS_C : 0;
+		default: return cpuFlagState.keep & FLAGS_C;
+	}
+}
+
+// records a flag producing op, keep is evaluated before the previous op is replaced since it may read its flags
+#define FLAGS_LAZY(kind,opA,opB,opCarry,opResult,opKeep) { unsigned int lazyKeep = (opKeep); cpuFlagState.op = kind; cpuFlagState.a = opA; cpuFlagState.b = opB; cpuFlagState.carry = opCarry; cpuFlagState.result = opResult; cpuFlagState.keep = lazyKeep; }
+#define FLAGS_WRITE(x) { unsigned char newFlags = (x); cpuFlagState.op = FLAGOP_NONE; cpu.registers.f = newFlags; }
+
+#define FLAGS_ISZERO (cpuZeroFlag())
+#define FLAGS_ISCARRY (cpuCarryFlag())
+#define FLAGS_ISNEGATIVE (cpuSyncFlags(), cpu.registers.f & FLAGS_N)
+#define FLAGS_ISHALFCARRY (cpuSyncFlags(), cpu.registers.f & FLAGS_HC)
+#else
+inline void cpuSyncFlags() {
+}
+
+#define FLAGS_WRITE(x) { cpu.registers.f = (x); }
+
 #define FLAGS_ISZERO (cpu.registers.f & FLAGS_Z)
 #define FLAGS_ISNEGATIVE (cpu.registers.f & FLAGS_N)
 #define FLAGS_ISCARRY (cpu.registers.f & FLAGS_C)
 #define FLAGS_ISHALFCARRY (cpu.registers.f & FLAGS_HC)
+#endif
+
+#define FLAGS_ISSET(x) (cpuSyncFlags(), cpu.registers.f & (x))
+#define FLAGS_SET(x) (cpuSyncFlags(), cpu.registers.f |= (x))
+#define FLAGS_CLEAR(x) (cpuSyncFlags(), cpu.registers.f &= ~(x))
+
+// busy wait loop fast forward, short loops that only poll memory (LY, STAT, IF, a flag set by an interrupt handler,
+// etc) skip ahead over every iteration that would finish before the next event. Can be overridden by defining
+// IDLE_LOOP_SKIP as 0 or 1
+#ifndef IDLE_LOOP_SKIP
+#define IDLE_LOOP_SKIP 1
+#endif
+
+// largest loop checked in bytes, including the jump back
+#define IDLE_LOOP_MAX_SIZE 16
+
+#if IDLE_LOOP_SKIP
+struct cpu_idlestats {
+	unsigned long long cyclesSkipped;		// since the ROM was loaded
+	unsigned int fastForwards;				// number of times cycles were skipped
+	unsigned int loopsFound;				// number of times a loop was found to be a busy wait
+};
+
+extern cpu_idlestats cpuIdleStats;
+extern unsigned int cpuIdleLoopPC;
+extern unsigned int cpuIdleLoopRejected;		// start of the last loop that can't be skipped, so copy loops and the like stop calling in
+
+// called when a jump from end (the address after the jump) back to cpu.registers.pc is taken
+void cpuIdleLoopJump(unsigned int end);
+
+// a loop has to be seen running start to finish with no events in between before it can be skipped
+inline void cpuIdleLoopReset() {
+	cpuIdleLoopPC = 0xFFFFFFFF;
+}
+
+#define IDLE_LOOP_JUMP(end) { const unsigned int jumpEnd = (end); if (cpu.registers.pc < jumpEnd && jumpEnd - cpu.registers.pc <= IDLE_LOOP_MAX_SIZE && cpu.registers.pc != cpuIdleLoopRejected) cpuIdleLoopJump(jumpEnd); }
+#else
+inline void cpuIdleLoopReset() {
+}
 
-#define FLAGS_ISSET(x) (cpu.registers.f & (x))
-#define FLAGS_SET(x) (cpu.registers.f |= (x))
-#define FLAGS_CLEAR(x) (cpu.registers.f &= ~(x))
+// still uses the jump target so the handlers that keep it in a local build without warnings
+#define IDLE_LOOP_JUMP(end) ((void) (end))
+#endif
 
 // resets CPU to default GB settings
 void cpuReset(void);
@@ -0,0 +1,550 @@
+
+// x86-64 recompiler for hot basic blocks (host builds only, see CPU_JIT in cpu.h)
+//
+// Blocks from the block cache that are entered JIT_HOT_COUNT times are translated to native code. Simple loads,
+// stores and register moves are emitted directly, everything else calls a per opcode helper built from the same
+// instruction lists as the interpreter so the semantics can't drift. Memory accesses only call back into
+// readByte/writeByte for pages that need it (I/O, ROM bank validation, MBC writes).
+//
+// Translated code lives with its block so it is thrown away whenever the block decodes again (ROM cache slot
+// reloaded, or the RAM page it runs from written to). Blocks jump directly to their last successors when those
+// are still valid and every instruction of the successor starts before the next scheduled event, and leave early
+// when an instruction moves the next event closer, so events fire on exactly the same instruction as in the
+// interpreter.
+//
+// Register use in translated code:
+//   rbx = &cpu.registers
+//   r12 = generation counter of the page the current block runs from, r13d = its value on entry
+
+#include <sys/mman.h>
+
+#define JIT_HOT_COUNT 8
+#define JIT_BUFFER_SIZE (16 * 1024 * 1024)
+#define JIT_MAX_BLOCK_SIZE 4096
+
+typedef void(*jit_enter_func)(const unsigned int* runGen, unsigned int runGenValue, void* code);
+
+static unsigned char* jitBuffer = NULL;
+static unsigned int jitUsed = 0;
+static unsigned int jitStubsSize = 0;
+static unsigned char* jitOut = NULL;
+
+static jit_enter_func jitEnter = NULL;
+static unsigned char* jitExit = NULL;
+static unsigned char* jitChain = NULL;
+
+// block that failed to chain on the last exit, and the one that should be linked to it on the next run
+static cpu_block* jitExitBlock = NULL;
+static cpu_block* jitFrom = NULL;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Per opcode helpers, same bodies as the interpreter handlers (which expect pc to point just past the opcode)
+
+#define INSTRUCTION_0(name,numticks,func,id,code)   static void jitOp_##id(unsigned int) { func(); cpu.clocks += numticks; code }
+#define INSTRUCTION_1(name,numticks,func,id,code)   static void jitOp_##id(unsigned int imm) { cpu.registers.pc += 1; func((unsigned char) imm); cpu.clocks += numticks; code }
+#define INSTRUCTION_1S(name,numticks,func,id,code)  static void jitOp_##id(unsigned int imm) { cpu.registers.pc += 1; func((signed char) imm); cpu.clocks += numticks; code }
+#define INSTRUCTION_2(name,numticks,func,id,code)   static void jitOp_##id(unsigned int imm) { cpu.registers.pc += 2; func((unsigned short) imm); cpu.clocks += numticks; code }
+#define INSTRUCTION_L(name,numticks,func,id,code)
+#define INSTRUCTION_E(name,numticks,func,id,code)   static void jitOp_##id(unsigned int op) { func(*regMap[op & 7]); cpu.clocks += numticks; code }
+#define CB_INSTRUCTION(name,numticks,func,id,code)  static void jitCB_##id(unsigned int) { cpu.registers.pc += 1; func(); cpu.clocks += numticks; code }
+#define CB_INSTR______(name,numticks,func,id,code)
+#define CB_INSTRMAPPED(name,numticks,func,id,code)  static void jitCB_##id(unsigned int op) { cpu.registers.pc += 1; func(*regMap[op & 7]); cpu.clocks += numticks; code }
+#include "cpu_instructions.inl"
+#include "cb_instructions.inl"
+#undef INSTRUCTION_0
+#undef INSTRUCTION_1
+#undef INSTRUCTION_1S
+#undef INSTRUCTION_2
+#undef INSTRUCTION_L
+#undef INSTRUCTION_E
+#undef CB_INSTRUCTION
+#undef CB_INSTR______
+#undef CB_INSTRMAPPED
+
+static void jitOpUndefined(unsigned int) {
+	undefined();
+}
+
+static unsigned int jitReadByte(unsigned int address) {
+	return readByte(address);
+}
+
+static void jitWriteByte(unsigned int address, unsigned int value) {
+	writeByte(address, (unsigned char) value);
+}
+
+static void(*jitOpHelpers[256])(unsigned int);
+static void(*jitCBHelpers[256])(unsigned int);
+static unsigned char jitTicks[256];
+static unsigned char jitCBTicks[256];
+
+static void jitInitTables() {
+	// register mapped instructions are listed as a run of INSTRUCTION_L followed by the INSTRUCTION_E they share
+	int pending[8];
+	int numPending = 0;
+
+	for (int op = 0; op < 256; op++) {
+		jitOpHelpers[op] = jitOpUndefined;
+		jitTicks[op] = 0;
+	}
+
+	// only the handlers are wanted here, not the special code
+	#define JIT_SET_OP(table,id,func,numticks,code) { table[id] = func; jitTicks[id] = numticks; }
+	#define JIT_SET_PENDING(table,func,numticks) while (numPending) { numPending--; table[pending[numPending]] = func; jitCBTicks[pending[numPending]] = numticks; }
+
+	#define INSTRUCTION_0(name,numticks,func,id,code)   JIT_SET_OP(jitOpHelpers, id, jitOp_##id, numticks, code)
+	#define INSTRUCTION_1(name,numticks,func,id,code)   JIT_SET_OP(jitOpHelpers, id, jitOp_##id, numticks, code)
+	#define INSTRUCTION_1S(name,numticks,func,id,code)  JIT_SET_OP(jitOpHelpers, id, jitOp_##id, numticks, code)
+	#define INSTRUCTION_2(name,numticks,func,id,code)   JIT_SET_OP(jitOpHelpers, id, jitOp_##id, numticks, code)
+	#define INSTRUCTION_L(name,numticks,func,id,code)   pending[numPending++] = id;
+	#define INSTRUCTION_E(name,numticks,func,id,code)   JIT_SET_OP(jitOpHelpers, id, jitOp_##id, numticks, code) \
+														while (numPending) { numPending--; jitOpHelpers[pending[numPending]] = jitOp_##id; jitTicks[pending[numPending]] = numticks; }
+	#define CB_INSTRUCTION(name,numticks,func,id,code)  jitCBHelpers[id] = jitCB_##id; jitCBTicks[id] = numticks;
+	#define CB_INSTR______(name,numticks,func,id,code)  pending[numPending++] = id;
+	#define CB_INSTRMAPPED(name,numticks,func,id,code)  jitCBHelpers[id] = jitCB_##id; jitCBTicks[id] = numticks; JIT_SET_PENDING(jitCBHelpers, jitCB_##id, numticks)
+	#include "cpu_instructions.inl"
+	#include "cb_instructions.inl"
+	#undef INSTRUCTION_0
+	#undef INSTRUCTION_1
+	#undef INSTRUCTION_1S
+	#undef INSTRUCTION_2
+	#undef INSTRUCTION_L
+	#undef INSTRUCTION_E
+	#undef CB_INSTRUCTION
+	#undef CB_INSTR______
+	#undef CB_INSTRMAPPED
+	#undef JIT_SET_OP
+	#undef JIT_SET_PENDING
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Emitter
+
+enum jit_reg {
+	JIT_RAX = 0,
+	JIT_RCX = 1,
+	JIT_RDX = 2,
+	JIT_RBX = 3,
+	JIT_RSI = 6,
+	JIT_RDI = 7,
+	JIT_R8 = 8,
+	JIT_R10 = 10,
+	JIT_R12 = 12,
+};
+
+// condition codes for jitJcc
+#define JIT_CC_B 0x2
+#define JIT_CC_AE 0x3
+#define JIT_CC_E 0x4
+#define JIT_CC_NE 0x5
+
+// offset of a cpu field from rbx
+#define JIT_CPU(field) (int) ((unsigned char*) &cpu.field - (unsigned char*) &cpu.registers)
+
+inline void jitEmit8(unsigned int value) {
+	*jitOut++ = (unsigned char) value;
+}
+
+inline void jitEmit32(unsigned int value) {
+	memcpy(jitOut, &value, 4);
+	jitOut += 4;
+}
+
+inline void jitEmit64(const void* value) {
+	memcpy(jitOut, &value, 8);
+	jitOut += 8;
+}
+
+// emits a series of literal bytes
+static void jitEmitBytes(const char* bytes, int count) {
+	memcpy(jitOut, bytes, count);
+	jitOut += count;
+}
+#define JIT_BYTES(str) jitEmitBytes(str, sizeof(str) - 1)
+
+// mov reg64, imm64
+static void jitMovImm64(int reg, const void* value) {
+	jitEmit8(0x48 | (reg >> 3));
+	jitEmit8(0xB8 + (reg & 7));
+	jitEmit64(value);
+}
+
+// op reg32, [rbx + disp32] (or the reverse, depending on op)
+static void jitRbx(int op, int reg, int disp) {
+	if (op > 0xFF) jitEmit8(op >> 8);
+	jitEmit8(op & 0xFF);
+	jitEmit8(0x83 | (reg << 3));
+	jitEmit32(disp);
+}
+
+static void jitCall(const void* func) {
+	jitMovImm64(JIT_RAX, func);
+	JIT_BYTES("\xFF\xD0");						// call rax
+}
+
+// conditional jump with rel32 that is patched later, returns the location to patch
+static unsigned char* jitJcc(int cc) {
+	jitEmit8(0x0F);
+	jitEmit8(0x80 | cc);
+	unsigned char* patch = jitOut;
+	jitEmit32(0);
+	return patch;
+}
+
+static unsigned char* jitJmp() {
+	jitEmit8(0xE9);
+	unsigned char* patch = jitOut;
+	jitEmit32(0);
+	return patch;
+}
+
+static void jitPatch(unsigned char* patch, const unsigned char* target) {
+	unsigned int rel = (unsigned int) (target - (patch + 4));
+	memcpy(patch, &rel, 4);
+}
+
+static void jitJmpTo(const unsigned char* target) {
+	jitPatch(jitJmp(), target);
+}
+
+static void jitAddClocks(int clocks) {
+	if (clocks) {
+		jitRbx(0x81, 0, JIT_CPU(clocks));		// add dword [rbx + clocks], imm32
+		jitEmit32(clocks);
+	}
+}
+
+static void jitSetPC(unsigned int pc) {
+	jitRbx(0xC7, 0, JIT_CPU(registers.pc));		// mov dword [rbx + pc], imm32
+	jitEmit32(pc);
+}
+
+// emits the enter, exit and chain stubs at the start of the buffer
+static void jitEmitStubs() {
+	jitOut = jitBuffer;
+
+	// void enter(runGen, runGenValue, code), three pushes keep the stack aligned for helper calls
+	jitEnter = (jit_enter_func) jitOut;
+	JIT_BYTES("\x53\x41\x54\x41\x55");			// push rbx, r12, r13
+	jitMovImm64(JIT_RBX, &cpu.registers);
+	JIT_BYTES("\x49\x89\xFC");					// mov r12, rdi
+	JIT_BYTES("\x41\x89\xF5");					// mov r13d, esi
+	JIT_BYTES("\xFF\xE2");						// jmp rdx
+
+	jitExit = jitOut;
+	JIT_BYTES("\x41\x5D\x41\x5C\x5B\xC3");		// pop r13, r12, rbx, ret
+
+	// rsi = block that just finished, tries to jump straight into one of its linked successors. Same checks as the
+	// block lookup in cpuStep, including the successor starting all of its instructions before the next event
+	jitChain = jitOut;
+	jitRbx(0x8B, JIT_RAX, JIT_CPU(registers.pc));		// mov eax, [rbx + pc]
+	for (int link = 0; link < 2; link++) {
+		unsigned char* fail[7];
+		JIT_BYTES("\x48\x8B\x96");						// mov rdx, [rsi + link]
+		jitEmit32(offsetof(cpu_block, jitLink) + link * sizeof(cpu_block*));
+		JIT_BYTES("\x48\x85\xD2");						// test rdx, rdx
+		fail[0] = jitJcc(JIT_CC_E);
+		JIT_BYTES("\x3B\x82");							// cmp eax, [rdx + pc]
+		jitEmit32(offsetof(cpu_block, pc));
+		fail[1] = jitJcc(JIT_CC_NE);
+		jitRbx(0x8B, JIT_RCX, JIT_CPU(clocks));			// mov ecx, [rbx + clocks]
+		JIT_BYTES("\x03\x8A");							// add ecx, [rdx + jitClocks]
+		jitEmit32(offsetof(cpu_block, jitClocks));
+		jitMovImm64(JIT_R10, &eventNextClock);
+		JIT_BYTES("\x41\x3B\x0A");						// cmp ecx, [r10]
+		fail[2] = jitJcc(JIT_CC_AE);
+		JIT_BYTES("\x4C\x8B\x82");						// mov r8, [rdx + jitCode]
+		jitEmit32(offsetof(cpu_block, jitCode));
+		JIT_BYTES("\x4D\x85\xC0");						// test r8, r8
+		fail[6] = jitJcc(JIT_CC_E);
+		JIT_BYTES("\x4C\x8B\x8A");						// mov r9, [rdx + validGen]
+		jitEmit32(offsetof(cpu_block, validGen));
+		JIT_BYTES("\x45\x8B\x09");						// mov r9d, [r9]
+		JIT_BYTES("\x44\x3B\x8A");						// cmp r9d, [rdx + validGenValue]
+		jitEmit32(offsetof(cpu_block, validGenValue));
+		fail[3] = jitJcc(JIT_CC_NE);
+		JIT_BYTES("\x89\xC1\xC1\xE9\x08\x0F\xB6\xC9");	// mov ecx, eax; shr ecx, 8; movzx ecx, cl
+		jitMovImm64(JIT_R10, readMap);
+		JIT_BYTES("\x4D\x8B\x14\xCA");					// mov r10, [r10 + rcx * 8]
+		JIT_BYTES("\x4D\x85\xD2");						// test r10, r10
+		fail[4] = jitJcc(JIT_CC_E);
+		JIT_BYTES("\x44\x0F\xB6\xD8");					// movzx r11d, al
+		JIT_BYTES("\x4D\x01\xDA");						// add r10, r11
+		JIT_BYTES("\x4C\x3B\x92");						// cmp r10, [rdx + start]
+		jitEmit32(offsetof(cpu_block, start));
+		fail[5] = jitJcc(JIT_CC_NE);
+		jitMovImm64(JIT_R12, cpuPageGeneration);
+		JIT_BYTES("\x4D\x8D\x24\x8C");					// lea r12, [r12 + rcx * 4]
+		JIT_BYTES("\x45\x8B\x2C\x24");					// mov r13d, [r12]
+		JIT_BYTES("\x41\xFF\xE0");						// jmp r8
+
+		for (int f = 0; f < 7; f++) {
+			jitPatch(fail[f], jitOut);
+		}
+	}
+	jitMovImm64(JIT_RAX, &jitExitBlock);
+	JIT_BYTES("\x48\x89\x30");							// mov [rax], rsi
+	jitJmpTo(jitExit);
+
+	jitStubsSize = jitUsed = (unsigned int) (jitOut - jitBuffer);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Translation
+
+// early exit after an instruction that changed the running page's generation or moved the next event closer
+struct jit_earlyexit {
+	unsigned char* patch[2];
+	unsigned int pc;			// pc to store, or 0xFFFFFFFF if a helper already set it
+	int clocks;					// clocks not yet added
+};
+
+// loads the memory access address into ecx
+static void jitLoadAddress(unsigned char op, unsigned int imm16) {
+	switch (op) {
+		case 0x0a: case 0x02:
+			jitRbx(0x8B, JIT_RCX, JIT_CPU(registers.bc));	// mov ecx, [rbx + bc]
+			break;
+		case 0x1a: case 0x12:
+			jitRbx(0x8B, JIT_RCX, JIT_CPU(registers.de));	// mov ecx, [rbx + de]
+			break;
+		case 0xfa: case 0xea:
+			jitEmit8(0xB9);								// mov ecx, imm32
+			jitEmit32(imm16);
+			break;
+		default:
+			jitRbx(0x8B, JIT_RCX, JIT_CPU(registers.hl));	// mov ecx, [rbx + hl]
+			break;
+	}
+}
+
+// readByte(ecx) into cl, calling back only for I/O and unvalidated ROM pages
+static void jitEmitRead() {
+	JIT_BYTES("\x89\xCA\xC1\xEA\x08");					// mov edx, ecx; shr edx, 8
+	jitMovImm64(JIT_RAX, readMap);
+	JIT_BYTES("\x48\x8B\x04\xD0");						// mov rax, [rax + rdx * 8]
+	JIT_BYTES("\x48\x85\xC0");						// test rax, rax
+	unsigned char* slow = jitJcc(JIT_CC_E);
+	JIT_BYTES("\x0F\xB6\xC9\x8A\x0C\x08");				// movzx ecx, cl; mov cl, [rax + rcx]
+	unsigned char* done = jitJmp();
+
+	jitPatch(slow, jitOut);
+	JIT_BYTES("\x89\xCF");								// mov edi, ecx
+	jitCall((const void*) jitReadByte);
+	JIT_BYTES("\x89\xC1");								// mov ecx, eax
+
+	jitPatch(done, jitOut);
+}
+
+// writeByte(ecx, dl), calling back only for I/O and MBC writes
+static void jitEmitWrite() {
+	JIT_BYTES("\x89\xC8\xC1\xE8\x08");					// mov eax, ecx; shr eax, 8
+	jitMovImm64(JIT_R8, writeMap);
+	JIT_BYTES("\x4D\x8B\x04\xC0");						// mov r8, [r8 + rax * 8]
+	JIT_BYTES("\x4D\x85\xC0");						// test r8, r8
+	unsigned char* slow = jitJcc(JIT_CC_E);
+	JIT_BYTES("\x44\x0F\xB6\xC9");						// movzx r9d, cl
+	JIT_BYTES("\x43\x88\x14\x08");						// mov [r8 + r9], dl
+	jitMovImm64(JIT_R8, cpuPageGeneration);
+	JIT_BYTES("\x41\xFF\x04\x80");						// inc dword [r8 + rax * 4]
+	unsigned char* done = jitJmp();
+
+	jitPatch(slow, jitOut);
+	JIT_BYTES("\x89\xCF\x89\xD6");						// mov edi, ecx; mov esi, edx
+	jitCall((const void*) jitWriteByte);
+
+	jitPatch(done, jitOut);
+}
+
+static void cpuJitResetCode() {
+	for (int i = 0; i < NUM_BLOCKS; i++) {
+		blockCache[i].jitCode = NULL;
+		blockCache[i].jitLink[0] = NULL;
+		blockCache[i].jitLink[1] = NULL;
+	}
+	jitUsed = jitStubsSize;
+	jitFrom = NULL;
+}
+
+static bool cpuJitTranslate(cpu_block* block) {
+	if (!jitBuffer) {
+		void* buffer = mmap(NULL, JIT_BUFFER_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (buffer == MAP_FAILED) {
+			// no executable memory, stay with the interpreter
+			return false;
+		}
+		jitBuffer = (unsigned char*) buffer;
+		jitInitTables();
+		jitEmitStubs();
+	}
+
+	if (jitUsed + JIT_MAX_BLOCK_SIZE > JIT_BUFFER_SIZE) {
+		cpuJitResetCode();
+	}
+
+	static const int regOffset[8] = {
+		JIT_CPU(registers.b), JIT_CPU(registers.c), JIT_CPU(registers.d), JIT_CPU(registers.e),
+		JIT_CPU(registers.h), JIT_CPU(registers.l), 0, JIT_CPU(registers.a)
+	};
+	static const int pairOffset[4] = {
+		JIT_CPU(registers.bc), JIT_CPU(registers.de), JIT_CPU(registers.hl), JIT_CPU(registers.sp)
+	};
+
+	jit_earlyexit exits[MAX_BLOCK_INSTRS];
+	int numExits = 0;
+
+	jitOut = jitBuffer + jitUsed;
+	unsigned char* code = jitOut;
+
+	// clocks of the instructions after each one up to (not including) the last, the rest of the block only runs
+	// if all of those start before the next event
+	unsigned int clocksAfter[MAX_BLOCK_INSTRS];
+	unsigned int staticClocks = 0;
+	for (int k = block->numInstrs - 2; k >= 0; k--) {
+		clocksAfter[k] = staticClocks;
+		const cpu_blockinstr& instr = block->instrs[k];
+		staticClocks += instr.opcode == 0xcb ? jitCBTicks[instr.imm8] : jitTicks[instr.opcode];
+	}
+	block->jitClocks = staticClocks;
+
+	unsigned int address = block->pc;
+	int clocks = 0;
+	bool pcSet = false;
+
+	for (int k = 0; k < block->numInstrs; k++) {
+		const cpu_blockinstr& instr = block->instrs[k];
+		const unsigned char op = instr.opcode;
+		const unsigned int next = address + opLength[op];
+		const int ticks = jitTicks[op];
+		bool checkGen = true;
+		pcSet = false;
+
+		if (op == 0x00) {
+			// NOP
+			clocks += ticks;
+			checkGen = false;
+		} else if (op >= 0x40 && op < 0x80 && (op & 7) != 6 && (op & 0x38) != 0x30) {
+			// LD r, r
+			jitRbx(0x8A, JIT_RAX, regOffset[op & 7]);				// mov al, [rbx + src]
+			jitRbx(0x88, JIT_RAX, regOffset[(op >> 3) & 7]);		// mov [rbx + dst], al
+			clocks += ticks;
+			checkGen = false;
+		} else if ((op & 0xC7) == 0x06 && op != 0x36) {
+			// LD r, n
+			jitRbx(0xC6, 0, regOffset[(op >> 3) & 7]);				// mov byte [rbx + dst], imm8
+			jitEmit8(instr.imm8);
+			clocks += ticks;
+			checkGen = false;
+		} else if ((op & 0xCF) == 0x01) {
+			// LD rr, nn
+			jitRbx(0xC7, 0, pairOffset[op >> 4]);					// mov dword [rbx + dst], imm32
+			jitEmit32(instr.imm16);
+			clocks += ticks;
+			checkGen = false;
+		} else if (((op & 0xCF) == 0x03 || (op & 0xCF) == 0x0B) && op < 0x30) {
+			// INC rr, DEC rr (not SP, which isn't masked to 16 bits)
+			jitRbx(0x8B, JIT_RAX, pairOffset[op >> 4]);				// mov eax, [rbx + rr]
+			if (op & 0x08) JIT_BYTES("\xFF\xC8"); else JIT_BYTES("\xFF\xC0");	// dec/inc eax
+			JIT_BYTES("\x0F\xB7\xC0");								// movzx eax, ax
+			jitRbx(0x89, JIT_RAX, pairOffset[op >> 4]);				// mov [rbx + rr], eax
+			clocks += ticks;
+			checkGen = false;
+		} else if ((op >= 0x40 && op < 0x80 && (op & 7) == 6 && op != 0x76) || op == 0x0a || op == 0x1a || op == 0xfa) {
+			// LD r, (HL) / LD A, (BC) / LD A, (DE) / LD A, (nn)
+			jitAddClocks(clocks);
+			clocks = 0;
+			jitLoadAddress(op, instr.imm16);
+			jitEmitRead();
+			jitRbx(0x88, JIT_RCX, regOffset[op >= 0x40 && op < 0x80 ? (op >> 3) & 7 : 7]);	// mov [rbx + dst], cl
+			clocks += ticks;
+		} else if ((op >= 0x70 && op < 0x78 && op != 0x76) || op == 0x36 || op == 0x02 || op == 0x12 || op == 0xea) {
+			// LD (HL), r / LD (HL), n / LD (BC), A / LD (DE), A / LD (nn), A
+			jitAddClocks(clocks);
+			clocks = 0;
+			jitLoadAddress(op, instr.imm16);
+			if (op == 0x36) {
+				jitEmit8(0xBA);										// mov edx, imm32
+				jitEmit32(instr.imm8);
+			} else {
+				jitRbx(0x0FB6, JIT_RDX, regOffset[op >= 0x70 && op < 0x78 ? op & 7 : 7]);	// movzx edx, byte [rbx + src]
+			}
+			jitEmitWrite();
+			clocks += ticks;
+		} else if (op == 0xc3 || op == 0x18) {
+			// JP nn / JR n, always the end of the block
+			jitSetPC(op == 0xc3 ? instr.imm16 : next + (signed char) instr.imm8);
+			clocks += ticks;
+			pcSet = true;
+			checkGen = false;
+		} else {
+			jitAddClocks(clocks);
+			clocks = 0;
+			jitSetPC(address + 1);
+			jitEmit8(0xBF);											// mov edi, imm32
+			if (op == 0xcb) {
+				jitEmit32(instr.imm8);
+				jitCall((const void*) jitCBHelpers[instr.imm8]);
+			} else {
+				jitEmit32(opLength[op] == 3 ? instr.imm16 : (opLength[op] == 2 ? instr.imm8 : op));
+				jitCall((const void*) jitOpHelpers[op]);
+			}
+			pcSet = true;
+		}
+
+		// running page touched (memory write, bank switch, etc), leave like the interpreter does. Anything that can
+		// touch memory can also reschedule an event (interrupt flag, timer control) so the rest of the block has to
+		// still fit before it. The last instruction goes through the chain checks instead
+		if (checkGen && k + 1 < block->numInstrs) {
+			JIT_BYTES("\x45\x39\x2C\x24");							// cmp [r12], r13d
+			exits[numExits].patch[0] = jitJcc(JIT_CC_NE);
+			jitRbx(0x8B, JIT_RAX, JIT_CPU(clocks));					// mov eax, [rbx + clocks]
+			jitEmit8(0x05);											// add eax, imm32
+			jitEmit32(clocks + clocksAfter[k]);
+			jitMovImm64(JIT_R8, &eventNextClock);
+			JIT_BYTES("\x41\x3B\x00");								// cmp eax, [r8]
+			exits[numExits].patch[1] = jitJcc(JIT_CC_AE);
+			exits[numExits].pc = pcSet ? 0xFFFFFFFF : next;
+			exits[numExits].clocks = clocks;
+			numExits++;
+		}
+
+		address = next;
+	}
+
+	// end of block
+	if (!pcSet) {
+		jitSetPC(address);
+	}
+	jitAddClocks(clocks);
+	jitMovImm64(JIT_RSI, block);
+	jitJmpTo(jitChain);
+
+	for (int e = 0; e < numExits; e++) {
+		jitPatch(exits[e].patch[0], jitOut);
+		jitPatch(exits[e].patch[1], jitOut);
+		if (exits[e].pc != 0xFFFFFFFF) {
+			jitSetPC(exits[e].pc);
+		}
+		jitAddClocks(exits[e].clocks);
+		jitJmpTo(jitExit);
+	}
+
+	DebugAssert(jitOut - code <= JIT_MAX_BLOCK_SIZE);
+	jitUsed = (unsigned int) (jitOut - jitBuffer);
+	block->jitCode = code;
+
+	return true;
+}
+
+// runs the translated block and any chained successors until the next event (the first block has to fit before it)
+static void cpuJitRun(cpu_block* block, unsigned int page) {
+	// link the block that couldn't chain last time to this one so it can next time
+	if (jitFrom && jitFrom->jitCode && jitFrom->jitLink[0] != block && jitFrom->jitLink[1] != block) {
+		jitFrom->jitLink[1] = jitFrom->jitLink[0];
+		jitFrom->jitLink[0] = block;
+	}
+
+	jitExitBlock = NULL;
+	jitEnter(&cpuPageGeneration[page], cpuPageGeneration[page], block->jitCode);
+	jitFrom = jitExitBlock;
+}
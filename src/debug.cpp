@@ -45,6 +45,7 @@ void failedAssert(const char* assertion) {
 void LogRegisters(void) {
 	OutputLog("Registers:\n");
 	OutputLog(BORDER);
+	cpuSyncFlags();
 	OutputLog("AF: 0x%04x\n", cpu.registers.af);
 	OutputLog("BC: 0x%04x\n", cpu.registers.bc);
 	OutputLog("DE: 0x%04x\n", cpu.registers.de);
@@ -88,7 +88,8 @@ void DmaDrawStrip(void* srcAddress, unsigned int size) {
 	*DMA0_CHCR_0 |= 1;//Enable channel0 DMA
 }
 
-inline void flushScanBuffer(int startX, int endX, int startY, int endY, int scanBufferSize) {
+// sends transferSize bytes from the front of the current scan buffer
+inline void flushScanBuffer(int startX, int endX, int startY, int endY, int scanBufferSize, int transferSize) {
 	TIME_SCOPE();
 
 	DmaWaitNext();
@@ -97,12 +98,22 @@ inline void flushScanBuffer(int startX, int endX, int startY, int endY, int scan
 	Bdisp_DefineDMARange(startX, endX, startY, endY);
 	Bdisp_DDRegisterSelect(LCD_GRAM);
 
-	DmaDrawStrip(&scanGroup[curScanBuffer * scanBufferSize], scanBufferSize);
+	DmaDrawStrip(&scanGroup[curScanBuffer * scanBufferSize], transferSize);
 	curScanBuffer = 1 - curScanBuffer;
 
 	curScan = 0;
 }
 
+// number of lines from start in the buffered strip that changed this frame, counted in steps of two lines (either
+// changing) for the scaled modes, 0 if the line at start is unchanged and stays on screen
+static inline int changedRun(int firstLine, int start, int bufferLines, int step) {
+	int end = start;
+	while (end < bufferLines && (gpuLineDirty(firstLine + end) || gpuLineDirty(firstLine + end + step - 1))) {
+		end += step;
+	}
+	return end - start;
+}
+
 void resolveScanline_NONE() {
 	TIME_SCOPE();
 
@@ -111,20 +122,30 @@ void resolveScanline_NONE() {
 
 	curScan++;
 	if (curScan == bufferLines) {
-		// we've rendered as much as we can buffer, resolve to pixels and DMA it:
-		unsigned char* curLineBuffer = ((unsigned char*)0xE5017000);
-		unsigned int* scanline = (unsigned int*)&scanGroup[curScanBuffer*scanBufferSize];
-		for (int i = 0; i < bufferLines; i++) {
-			lineBuffer = curLineBuffer + curLineBuffer[0];
-			DirectScanline16(scanline);
-			scanline += 80;
-			curLineBuffer += lineBufferSize;
-
-			condSoundUpdate();
-		}
+		// we've rendered as much as we can buffer, resolve the changed lines to pixels and DMA them:
+		const int firstLine = gpuLineRegs.line - bufferLines + 1;
+		for (int runStart = 0; runStart < bufferLines;) {
+			const int runLines = changedRun(firstLine, runStart, bufferLines, 1);
+			if (runLines == 0) {
+				runStart++;
+				continue;
+			}
 
-		// send DMA
-		flushScanBuffer(118, 277, 36 + cpu.memory.LY_lcdline - bufferLines + 1, 36 + cpu.memory.LY_lcdline, scanBufferSize);
+			unsigned char* curLineBuffer = ((unsigned char*)0xE5017000) + runStart * lineBufferSize;
+			unsigned int* scanline = (unsigned int*)&scanGroup[curScanBuffer*scanBufferSize];
+			for (int i = 0; i < runLines; i++) {
+				lineBuffer = curLineBuffer + curLineBuffer[0];
+				DirectScanline16(scanline);
+				scanline += 80;
+				curLineBuffer += lineBufferSize;
+
+				condSoundUpdate();
+			}
+
+			// send DMA
+			flushScanBuffer(118, 277, 36 + firstLine + runStart, 36 + firstLine + runStart + runLines - 1, scanBufferSize, scanBufferSize * runLines / bufferLines);
+			runStart += runLines;
+		}
 
 		// move line buffer to front
 		lineBuffer = ((unsigned char*)0xE5017000);
@@ -149,23 +170,33 @@ void resolveScanline_LO_200(void) {
 	
 	curScan++;
 	if (curScan == bufferLines) {
-		// we've rendered as much as we can buffer, resolve to pixels and DMA it:
-		unsigned char* curLineBuffer = ((unsigned char*)0xE5017000);
-		unsigned int* scanline = (unsigned int*)&scanGroup[curScanBuffer*scanBufferSize];
-		for (int i = 0; i < bufferLines; i += 2) {
-			prevLineBuffer = curLineBuffer + curLineBuffer[0];
-			lineBuffer = curLineBuffer + lineBufferSize + curLineBuffer[lineBufferSize];
-
-			DirectTripleScanline32(scanline, scanline + 160, scanline + 320);
-			scanline += 480;
-			curLineBuffer += lineBufferSize * 2;
-
-			condSoundUpdate();
-		}
+		// we've rendered as much as we can buffer, resolve the changed lines to pixels and DMA them:
+		const int firstLine = gpuLineRegs.line - bufferLines + 1;
+		for (int runStart = 0; runStart < bufferLines;) {
+			const int runLines = changedRun(firstLine, runStart, bufferLines, 2);
+			if (runLines == 0) {
+				runStart += 2;
+				continue;
+			}
+
+			unsigned char* curLineBuffer = ((unsigned char*)0xE5017000) + runStart * lineBufferSize;
+			unsigned int* scanline = (unsigned int*)&scanGroup[curScanBuffer*scanBufferSize];
+			for (int i = 0; i < runLines; i += 2) {
+				prevLineBuffer = curLineBuffer + curLineBuffer[0];
+				lineBuffer = curLineBuffer + lineBufferSize + curLineBuffer[lineBufferSize];
+
+				DirectTripleScanline32(scanline, scanline + 160, scanline + 320);
+				scanline += 480;
+				curLineBuffer += lineBufferSize * 2;
 
-		// send DMA
-		int startLine = (cpu.memory.LY_lcdline - bufferLines + 1) * 3 / 2;
-		flushScanBuffer(38, 357, startLine, startLine + bufferLines * 3 / 2 - 1, scanBufferSize);
+				condSoundUpdate();
+			}
+
+			// send DMA
+			int startLine = (firstLine + runStart) * 3 / 2;
+			flushScanBuffer(38, 357, startLine, startLine + runLines * 3 / 2 - 1, scanBufferSize, scanBufferSize * runLines / bufferLines);
+			runStart += runLines;
+		}
 
 		// move line buffer to front
 		lineBuffer = ((unsigned char*)0xE5017000);
@@ -183,23 +214,33 @@ void resolveScanline_HI_200(void) {
 	
 	curScan++;
 	if (curScan == bufferLines) {
-		// we've rendered as much as we can buffer, resolve to pixels and DMA it:
-		unsigned char* curLineBuffer = ((unsigned char*)0xE5017000);
-		unsigned int* scanline = (unsigned int*)&scanGroup[curScanBuffer*scanBufferSize];
-		for (int i = 0; i < bufferLines; i += 2) {
-			prevLineBuffer = curLineBuffer + curLineBuffer[0];
-			lineBuffer = curLineBuffer + lineBufferSize + curLineBuffer[lineBufferSize];
-
-			BlendTripleScanline32(scanline, scanline + 160, scanline + 320);
-			scanline += 480;
-			curLineBuffer += lineBufferSize * 2;
-
-			condSoundUpdate();
-		}
+		// we've rendered as much as we can buffer, resolve the changed lines to pixels and DMA them:
+		const int firstLine = gpuLineRegs.line - bufferLines + 1;
+		for (int runStart = 0; runStart < bufferLines;) {
+			const int runLines = changedRun(firstLine, runStart, bufferLines, 2);
+			if (runLines == 0) {
+				runStart += 2;
+				continue;
+			}
 
-		// send DMA
-		int startLine = (cpu.memory.LY_lcdline - bufferLines + 1) * 3 / 2;
-		flushScanBuffer(38, 357, startLine, startLine + bufferLines * 3 / 2 - 1, scanBufferSize);
+			unsigned char* curLineBuffer = ((unsigned char*)0xE5017000) + runStart * lineBufferSize;
+			unsigned int* scanline = (unsigned int*)&scanGroup[curScanBuffer*scanBufferSize];
+			for (int i = 0; i < runLines; i += 2) {
+				prevLineBuffer = curLineBuffer + curLineBuffer[0];
+				lineBuffer = curLineBuffer + lineBufferSize + curLineBuffer[lineBufferSize];
+
+				BlendTripleScanline32(scanline, scanline + 160, scanline + 320);
+				scanline += 480;
+				curLineBuffer += lineBufferSize * 2;
+
+				condSoundUpdate();
+			}
+
+			// send DMA
+			int startLine = (firstLine + runStart) * 3 / 2;
+			flushScanBuffer(38, 357, startLine, startLine + runLines * 3 / 2 - 1, scanBufferSize, scanBufferSize * runLines / bufferLines);
+			runStart += runLines;
+		}
 
 		// move line buffer to front
 		lineBuffer = ((unsigned char*)0xE5017000);
@@ -217,22 +258,32 @@ void resolveScanline_LO_150(void) {
 
 	curScan++;
 	if (curScan == bufferLines) {
-		unsigned char* curLineBuffer = ((unsigned char*)0xE5017000);
-		unsigned int* scanline = (unsigned int*)&scanGroup[curScanBuffer*scanBufferSize];
-		for (int i = 0; i < bufferLines; i += 2) {
-			prevLineBuffer = curLineBuffer + curLineBuffer[0];
-			lineBuffer = curLineBuffer + lineBufferSize + curLineBuffer[lineBufferSize];
+		const int firstLine = gpuLineRegs.line - bufferLines + 1;
+		for (int runStart = 0; runStart < bufferLines;) {
+			const int runLines = changedRun(firstLine, runStart, bufferLines, 2);
+			if (runLines == 0) {
+				runStart += 2;
+				continue;
+			}
 
-			DirectTripleScanline24(scanline, scanline + 120, scanline + 240);
-			scanline += 360;
-			curLineBuffer += lineBufferSize * 2;
+			unsigned char* curLineBuffer = ((unsigned char*)0xE5017000) + runStart * lineBufferSize;
+			unsigned int* scanline = (unsigned int*)&scanGroup[curScanBuffer*scanBufferSize];
+			for (int i = 0; i < runLines; i += 2) {
+				prevLineBuffer = curLineBuffer + curLineBuffer[0];
+				lineBuffer = curLineBuffer + lineBufferSize + curLineBuffer[lineBufferSize];
 
-			condSoundUpdate();
-		}
+				DirectTripleScanline24(scanline, scanline + 120, scanline + 240);
+				scanline += 360;
+				curLineBuffer += lineBufferSize * 2;
 
-		// send DMA
-		int startLine = (cpu.memory.LY_lcdline - bufferLines + 1) * 3 / 2;
-		flushScanBuffer(78, 317, startLine, startLine + bufferLines * 3 / 2 - 1, scanBufferSize);
+				condSoundUpdate();
+			}
+
+			// send DMA
+			int startLine = (firstLine + runStart) * 3 / 2;
+			flushScanBuffer(78, 317, startLine, startLine + runLines * 3 / 2 - 1, scanBufferSize, scanBufferSize * runLines / bufferLines);
+			runStart += runLines;
+		}
 
 		// move line buffer to front
 		lineBuffer = ((unsigned char*)0xE5017000);
@@ -250,23 +301,33 @@ void resolveScanline_HI_150(void) {
 
 	curScan++;
 	if (curScan == bufferLines) {
-		// we've rendered as much as we can buffer, resolve to pixels and DMA it:
-		unsigned char* curLineBuffer = ((unsigned char*)0xE5017000);
-		unsigned int* scanline = (unsigned int*)&scanGroup[curScanBuffer*scanBufferSize];
-		for (int i = 0; i < bufferLines; i += 2) {
-			prevLineBuffer = curLineBuffer + curLineBuffer[0] + 8;
-			lineBuffer = curLineBuffer + lineBufferSize + curLineBuffer[lineBufferSize] + 8;
-
-			BlendTripleScanline24(scanline, &prevLineBuffer[0], &lineBuffer[0], ppuPalette);
-			scanline += 360;
-			curLineBuffer += lineBufferSize * 2;
-
-			condSoundUpdate();
-		}
+		// we've rendered as much as we can buffer, resolve the changed lines to pixels and DMA them:
+		const int firstLine = gpuLineRegs.line - bufferLines + 1;
+		for (int runStart = 0; runStart < bufferLines;) {
+			const int runLines = changedRun(firstLine, runStart, bufferLines, 2);
+			if (runLines == 0) {
+				runStart += 2;
+				continue;
+			}
+
+			unsigned char* curLineBuffer = ((unsigned char*)0xE5017000) + runStart * lineBufferSize;
+			unsigned int* scanline = (unsigned int*)&scanGroup[curScanBuffer*scanBufferSize];
+			for (int i = 0; i < runLines; i += 2) {
+				prevLineBuffer = curLineBuffer + curLineBuffer[0] + 8;
+				lineBuffer = curLineBuffer + lineBufferSize + curLineBuffer[lineBufferSize] + 8;
+
+				BlendTripleScanline24(scanline, &prevLineBuffer[0], &lineBuffer[0], ppuPalette);
+				scanline += 360;
+				curLineBuffer += lineBufferSize * 2;
+
+				condSoundUpdate();
+			}
 
-		// send DMA
-		int startLine = (cpu.memory.LY_lcdline - bufferLines + 1) * 3 / 2;
-		flushScanBuffer(78, 317, startLine, startLine + bufferLines * 3 / 2 - 1, scanBufferSize);
+			// send DMA
+			int startLine = (firstLine + runStart) * 3 / 2;
+			flushScanBuffer(78, 317, startLine, startLine + runLines * 3 / 2 - 1, scanBufferSize, scanBufferSize * runLines / bufferLines);
+			runStart += runLines;
+		}
 
 		// move line buffer to front
 		lineBuffer = ((unsigned char*)0xE5017000);
@@ -282,7 +343,10 @@ void scanlineDMG(void) {
 
 	TIME_SCOPE();
 
-	RenderDMGScanline();
+	// unchanged lines are left out of the DMA, but still take their place in the strip
+	if (gpuLineNeedsRender(emulator.settings.scaleMode != emu_scale::NONE)) {
+		RenderDMGScanline();
+	}
 	resolveRenderedLine();
 }
 
@@ -292,10 +356,12 @@ void scanlineCGB() {
 
 	TIME_SCOPE();
 
-	RenderCGBScanline();
+	if (gpuLineNeedsRender(emulator.settings.scaleMode != emu_scale::NONE)) {
+		RenderCGBScanline();
 
-	if (cgb.dirtyPalette) {
-		cgbResolvePalette();
+		if (cgb.dirtyPalette) {
+			cgbResolvePalette();
+		}
 	}
 
 	resolveRenderedLine();
@@ -307,6 +373,7 @@ void scanlineBlank(void) {
 	TIME_SCOPE();
 
 	memset(lineBuffer, 0, 167);
+	gpuBlankLine();
 	resolveRenderedLine();
 }
 
@@ -449,6 +516,9 @@ void SetupDisplayDriver(char withFrameskip) {
 		default:
 			resolveRenderedLine = resolveScanline_NONE;
 	}
+
+	// the screen was drawn over since the lines were last sent
+	gpuInvalidateLines();
 }
 
 #endif
\ No newline at end of file
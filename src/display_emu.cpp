@@ -14,9 +14,14 @@ unsigned int framecounter = 0;
 bool skippingFrame = false;
 int frameSkip = 0;
 
-unsigned char useLineBuffer[lineBufferSize] = { 0 };
+PPU_LOCAL unsigned char useLineBuffer[lineBufferSize] = { 0 };
+#if PARALLEL_LINES
+// set by SetupDisplayThread, each render thread has its own
+PPU_LOCAL unsigned char* lineBuffer = NULL;
+#else
 unsigned char* lineBuffer = useLineBuffer;
-unsigned char prevLineBuffer[168] = { 0 };
+#endif
+PPU_LOCAL unsigned char prevLineBuffer[168] = { 0 };
 
 #include "tilerow.inl"
 #include "dmg_scanline.inl"
@@ -30,13 +35,13 @@ static void resolveLine() {
 	unsigned int* scanline;
 	switch (emulator.settings.scaleMode) {
 		case emu_scale::NONE:
-			scanline = (unsigned int*) (vram + 112 + LCD_WIDTH_PX * (cpu.memory.LY_lcdline + 36));
+			scanline = (unsigned int*) (vram + 112 + LCD_WIDTH_PX * (gpuLineRegs.line + 36));
 			DirectScanline16(scanline);
 			break;
 		case emu_scale::LO_150:
-			scanline = (unsigned int*)(vram + 72 + LCD_WIDTH_PX * ((cpu.memory.LY_lcdline * 3) / 2));
+			scanline = (unsigned int*)(vram + 72 + LCD_WIDTH_PX * ((gpuLineRegs.line * 3) / 2));
 
-			if (cpu.memory.LY_lcdline & 1) {
+			if (gpuLineRegs.line & 1) {
 				DirectScanline24(scanline);
 				DirectScanline24(scanline + LCD_WIDTH_PX / 2);
 			} else {
@@ -44,9 +49,9 @@ static void resolveLine() {
 			}
 			break;
 		case emu_scale::HI_150:
-			scanline = (unsigned int*) (vram + 72 + LCD_WIDTH_PX * ((cpu.memory.LY_lcdline * 3) / 2));
+			scanline = (unsigned int*) (vram + 72 + LCD_WIDTH_PX * ((gpuLineRegs.line * 3) / 2));
 
-			if (cpu.memory.LY_lcdline & 1) {
+			if (gpuLineRegs.line & 1) {
 				BlendMixedScanline24(scanline);
 				BlendScanline24(scanline + LCD_WIDTH_PX / 2);
 			} else {
@@ -55,18 +60,18 @@ static void resolveLine() {
 			}
 			break;
 		case emu_scale::LO_200:
-			scanline = (unsigned int*)(vram + 32 + LCD_WIDTH_PX * ((cpu.memory.LY_lcdline * 3) / 2));
+			scanline = (unsigned int*)(vram + 32 + LCD_WIDTH_PX * ((gpuLineRegs.line * 3) / 2));
 
-			if (cpu.memory.LY_lcdline & 1) {
+			if (gpuLineRegs.line & 1) {
 				DirectDoubleScanline32(scanline, scanline + LCD_WIDTH_PX / 2);
 			} else {
 				DirectScanline32(scanline);
 			}
 			break;
 		case emu_scale::HI_200:
-			scanline = (unsigned int*)(vram + 32 + LCD_WIDTH_PX * ((cpu.memory.LY_lcdline * 3) / 2));
+			scanline = (unsigned int*)(vram + 32 + LCD_WIDTH_PX * ((gpuLineRegs.line * 3) / 2));
 
-			if (cpu.memory.LY_lcdline & 1) {
+			if (gpuLineRegs.line & 1) {
 				BlendMixedScanline32(scanline);
 				DirectScanline32(scanline + LCD_WIDTH_PX / 2);
 			} else {
@@ -83,6 +88,10 @@ void renderEmu() {
 	if (skippingFrame)
 		return;
 
+	// unchanged lines are still on screen from last frame
+	if (!gpuLineNeedsRender(emulator.settings.scaleMode != emu_scale::NONE))
+		return;
+
 	TIME_SCOPE();
 
 	if (cgb.isCGB) {
@@ -102,8 +111,9 @@ void renderEmu() {
 void renderBlankEmu() {
 	TIME_SCOPE();
 
-	memset(lineBuffer, 0, sizeof(lineBuffer));
+	memset(lineBuffer, 0, lineBufferSize);
 	resolveLine();
+	gpuBlankLine();
 }
 
 void drawEmu() {
@@ -173,12 +183,24 @@ void(*renderScanline)(void) = renderEmu;
 void(*renderBlankScanline)(void) = renderBlankEmu;
 void(*drawFramebuffer)(void) = drawEmu;
 
+#if PARALLEL_LINES
+void SetupDisplayThread() {
+	lineBuffer = useLineBuffer;
+}
+#endif
+
 void SetupDisplayDriver(char withFrameskip) {
 	frameSkip = withFrameskip;
+#if PARALLEL_LINES
+	SetupDisplayThread();
+#endif
 
 	drawFramebuffer = drawEmu;
 	renderScanline = renderEmu;
 	renderBlankScanline = renderBlankEmu;
+
+	// the screen was drawn over since the lines were last sent
+	gpuInvalidateLines();
 }
 
 #endif
\ No newline at end of file
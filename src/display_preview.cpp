@@ -13,11 +13,11 @@
 #include "cgb_scanline.inl"
 
 static void renderPreviewLine() {
-	if ((cpu.memory.LY_lcdline & 1) == 0) {
+	if ((gpuLineRegs.line & 1) == 0) {
 		if (cgb.isCGB) {
 			RenderCGBScanline();
 
-			unsigned char* previewLine = &emulator.pausePreview[80 * cpu.memory.LY_lcdline / 2];
+			unsigned char* previewLine = &emulator.pausePreview[80 * gpuLineRegs.line / 2];
 			// every other pixel goes into the preview line, packed at 8 bpp
 			for (int i = 8; i < 168; i += 2) {
 				*(previewLine++) = lineBuffer[i] >> 2;
@@ -25,7 +25,7 @@ static void renderPreviewLine() {
 		} else {
 			RenderDMGScanline();
 
-			unsigned char* previewLine = &emulator.pausePreview[80 * cpu.memory.LY_lcdline / 2];
+			unsigned char* previewLine = &emulator.pausePreview[80 * gpuLineRegs.line / 2];
 			// every other pixel goes into the preview line, packed at 4 bpp
 			for (int i = 8; i < 168; i += 2) {
 				*(previewLine++) = (lineBuffer[i+1] << 2) | (lineBuffer[i] >> 2);
@@ -36,8 +36,8 @@ static void renderPreviewLine() {
 }
 
 static void renderPreviewBlankLine() {
-	if ((cpu.memory.LY_lcdline & 1) == 0) {
-		unsigned char* previewLine = &emulator.pausePreview[80 * cpu.memory.LY_lcdline / 2];
+	if ((gpuLineRegs.line & 1) == 0) {
+		unsigned char* previewLine = &emulator.pausePreview[80 * gpuLineRegs.line / 2];
 		memset(previewLine, 0, 80);
 	}
 }
@@ -50,6 +50,9 @@ static void renderPreviewScreen() {
 
 void enablePausePreview() {
 	if (renderScanline != renderPreviewLine) {
+		// lines already passed go to the display they were meant for
+		gpuCatchUp();
+
 		renderScanline = renderPreviewLine;
 		renderBlankScanline = renderPreviewBlankLine;
 		drawFramebuffer = renderPreviewScreen;
@@ -1,56 +1,72 @@
 #pragma once
 
 inline void RenderDMGScanline() {
-	int curLine = cpu.memory.LY_lcdline;
+	int curLine = gpuLineRegs.line;
 
 	// background/window
 	{
-		int i;
-
 		// tile offset and palette shared for window
-		const int tileOffset = ((~cpu.memory.LCDC_ctl) & LCDC_TILESET) << 4;
+		const int tileOffset = ((~gpuLineRegs.lcdc) & LCDC_TILESET) << 4;
 
 		// draw background
-		if (cpu.memory.LCDC_ctl & LCDC_BGENABLE)
+		if (gpuLineRegs.lcdc & LCDC_BGENABLE)
 		{
-			int y = ((curLine + cpu.memory.SCY_bgscrolly) & 7) * 2;
-
-			int mapOffset = ((cpu.memory.LCDC_ctl & LCDC_BGTILEMAP) ? 0x1c00 : 0x1800) +
-						    ((((curLine + cpu.memory.SCY_bgscrolly) & 255) >> 3) << 5);
-
 			// start to the left of pixel 8 (our leftmost linebuffer pixel) based on scrollx
 			unsigned char* scanline = &lineBuffer[8];
-			lineBuffer[0] = cpu.memory.SCX_bgscrollx & 7;
+			lineBuffer[0] = gpuLineRegs.scx & 7;
+
+			int lineOffset = gpuLineRegs.scx >> 3;
 
-			int lineOffset = cpu.memory.SCX_bgscrollx >> 3;
+#if BG_SURFACE
+			if (bgSurface) {
+				const unsigned char* surfaceLine = bgSurfaceLine((gpuLineRegs.lcdc & LCDC_BGTILEMAP) ? 1 : 0, (curLine + gpuLineRegs.scy) & 255);
+				bgSurfaceCopy(scanline, surfaceLine, lineOffset << 3, 168);
+			} else
+#endif
+			{
+				int y = ((curLine + gpuLineRegs.scy) & 7) * 2;
 
-			for (i = 0; i < 168; i += 8) {
-				int tile = vram[mapOffset + lineOffset];
-				if (!(tile & 0x80)) tile += tileOffset;
-				unsigned int tileRow = *((unsigned short*)&vram[tile * 16 + y]);
-				ShortSwap(tileRow);
+				int mapOffset = ((gpuLineRegs.lcdc & LCDC_BGTILEMAP) ? 0x1c00 : 0x1800) +
+								((((curLine + gpuLineRegs.scy) & 255) >> 3) << 5);
 
-				resolveTileRow<false>(scanline, tileRow);
+				for (int i = 0; i < 168; i += 8) {
+					int tile = vram[mapOffset + lineOffset];
+					if (!(tile & 0x80)) tile += tileOffset;
+					drawTileRow<false>(scanline, tile * 16 + y);
 
-				scanline += 8;
-				lineOffset = (lineOffset + 1) & 0x1F;
+					scanline += 8;
+					lineOffset = (lineOffset + 1) & 0x1F;
+				}
 			}
+		} else {
+			// background off shows color 0
+			lineBuffer[0] = gpuLineRegs.scx & 7;
+			memset(&lineBuffer[8], 0, 168);
 		}
 
 		// draw window
-		if (cpu.memory.LCDC_ctl & LCDC_WINDOWENABLE)
+		if (gpuLineRegs.lcdc & LCDC_WINDOWENABLE)
 		{
-			int wx = cpu.memory.WX_windowx;
-			int y = curLine - cpu.memory.WY_windowy + windowLineOffset;
+			int wx = gpuLineRegs.wx;
+			int y = curLine - gpuLineRegs.wy + gpuLineRegs.windowLine;
 
 			if (wx <= 166 && y >= 0) {
 				// select map offset row
-				int mapOffset = (cpu.memory.LCDC_ctl & LCDC_WINDOWTILEMAP) ? 0x1c00 : 0x1800;
+				int mapOffset = (gpuLineRegs.lcdc & LCDC_WINDOWTILEMAP) ? 0x1c00 : 0x1800;
 				mapOffset += (y >> 3) << 5;
 
+				unsigned char* scanline = &lineBuffer[wx+1+lineBuffer[0]];
+#if BG_SURFACE
+				if (bgSurface && y < 256) {
+					// whole tiles up to the right edge, leaves nothing for the tile loops below
+					const unsigned char* surfaceLine = bgSurfaceLine((gpuLineRegs.lcdc & LCDC_WINDOWTILEMAP) ? 1 : 0, y);
+					bgSurfaceCopy(scanline, surfaceLine, 0, (174 - wx) & ~7);
+					wx = 167;
+				}
+#endif
+
 				y = (y & 0x07) * 2;
 
-				unsigned char* scanline = &lineBuffer[wx+1+lineBuffer[0]];
 				bool unsafeAlignment = (size_t(scanline) & 3) != 0;
 				unsigned char* curTile = &vram[mapOffset];
 
@@ -58,10 +74,7 @@ inline void RenderDMGScanline() {
 					for (; wx < 167; wx += 8) {
 						int tile = *curTile++;
 						if (!(tile & 0x80)) tile += tileOffset;
-						unsigned int tileRow = *((unsigned short*)&vram[tile * 16 + y]);
-						ShortSwap(tileRow);
-
-						resolveTileRow<true>(scanline, tileRow);
+						drawTileRow<true>(scanline, tile * 16 + y);
 
 						scanline += 8;
 					}
@@ -69,10 +82,7 @@ inline void RenderDMGScanline() {
 					for (; wx < 167; wx += 8) {
 						int tile = *curTile++;
 						if (!(tile & 0x80)) tile += tileOffset;
-						unsigned int tileRow = *((unsigned short*)&vram[tile * 16 + y]);
-						ShortSwap(tileRow);
-
-						resolveTileRow<false>(scanline, tileRow);
+						drawTileRow<false>(scanline, tile * 16 + y);
 
 						scanline += 8;
 					}
@@ -82,11 +92,11 @@ inline void RenderDMGScanline() {
 	}
 
 	// if sprites enabled
-	if (cpu.memory.LCDC_ctl & LCDC_SPRITEENABLE)
+	if (gpuLineRegs.lcdc & LCDC_SPRITEENABLE)
 	{
 		int spriteSize;
 		int tileMask;
-		if (cpu.memory.LCDC_ctl & LCDC_SPRITEVDOUBLE) {
+		if (gpuLineRegs.lcdc & LCDC_SPRITEVDOUBLE) {
 			spriteSize = 16;
 			tileMask = 0xFE;
 		} else {
@@ -94,8 +104,14 @@ inline void RenderDMGScanline() {
 			tileMask = 0xFF;
 		}
 
+#if SPRITE_LISTS
+		const gpu_spriteline& spriteLine = getSpriteLine(curLine);
+		for (int i = 0; i < spriteLine.count; i++) {
+			const sprite_type* sprite = (const sprite_type*)(&oam[spriteLine.sprites[i] << 2]);
+#else
 		const sprite_type* sprite = (const sprite_type*)(&oam[156]);
 		for (int i = 39; i >= 0; i--, sprite--) {
+#endif
 			if (sprite->x && sprite->x < 168) {
 				int sy = sprite->y - 16;
 
@@ -107,15 +123,8 @@ inline void RenderDMGScanline() {
 					else y = curLine - sy;
 
 					// determine tile row colors
-					unsigned int tileRow = *((unsigned short*)&vram[tile * 16 + y * 2]);
-					ShortSwap(tileRow);
-
-					unsigned char colors[8];
-					if (!OAM_ATTR_XFLIP(sprite->attr)) {
-						resolveTileRow<false>(colors, tileRow);
-					} else {
-						resolveTileRowReverse<false>(colors, tileRow);
-					}
+					unsigned char colorBuffer[8];
+					const unsigned char* colors = getTileRowColors(colorBuffer, tile * 16 + y * 2, OAM_ATTR_XFLIP(sprite->attr) != 0);
 
 					// sprite position on scanline
 					unsigned char* scanline = &lineBuffer[sprite->x+lineBuffer[0]];
@@ -127,7 +127,7 @@ void emulator_screen::DrawPausePreview() {
 
 	// construct palette
 	if (!cgb.isCGB) {
-		if (!emulator.settings.useCGBColors || !getCGBTableEntry(&memoryMap[0][ROM_OFFSET_NAME], &ppuPalette[12])) {
+		if (!emulator.settings.useCGBColors || !getCGBTableEntry(&readMap[0][ROM_OFFSET_NAME], &ppuPalette[12])) {
 			colorpalette_type pal;
 			emulator.getPalette(emulator.settings.bgColorPalette, pal);
 			for (int i = 0; i < 4; i++) {
@@ -0,0 +1,161 @@
+#include "platform.h"
+#include "debug.h"
+
+#include "cpu.h"
+#include "memory.h"
+#include "gpu.h"
+#include "interrupts.h"
+#include "cgb.h"
+
+#include "events.h"
+
+unsigned int eventNextClock = 0xFFFFFFFF;
+
+static unsigned int eventClocks[EVENT_MAX];
+static unsigned char eventHeap[EVENT_MAX];			// event ids, binary min heap on eventClocks
+static unsigned int eventSlot[EVENT_MAX];			// heap index + 1 of each event, 0 when not scheduled
+static unsigned int eventCount = 0;
+
+static inline void eventPlace(unsigned int slot, unsigned int id) {
+	eventHeap[slot] = id;
+	eventSlot[id] = slot + 1;
+}
+
+static void eventSiftUp(unsigned int slot) {
+	const unsigned int id = eventHeap[slot];
+	while (slot) {
+		const unsigned int parent = (slot - 1) / 2;
+		if (eventClocks[eventHeap[parent]] <= eventClocks[id])
+			break;
+		eventPlace(slot, eventHeap[parent]);
+		slot = parent;
+	}
+	eventPlace(slot, id);
+}
+
+static void eventSiftDown(unsigned int slot) {
+	const unsigned int id = eventHeap[slot];
+	for (;;) {
+		unsigned int child = slot * 2 + 1;
+		if (child >= eventCount)
+			break;
+		if (child + 1 < eventCount && eventClocks[eventHeap[child + 1]] < eventClocks[eventHeap[child]])
+			child++;
+		if (eventClocks[id] <= eventClocks[eventHeap[child]])
+			break;
+		eventPlace(slot, eventHeap[child]);
+		slot = child;
+	}
+	eventPlace(slot, id);
+}
+
+static inline void eventUpdateNext() {
+	eventNextClock = eventCount ? eventClocks[eventHeap[0]] : 0xFFFFFFFF;
+}
+
+void eventSchedule(unsigned int id, unsigned int clocks) {
+	if (eventSlot[id]) {
+		const unsigned int prevClocks = eventClocks[id];
+		eventClocks[id] = clocks;
+		if (clocks < prevClocks) {
+			eventSiftUp(eventSlot[id] - 1);
+		} else {
+			eventSiftDown(eventSlot[id] - 1);
+		}
+	} else {
+		eventClocks[id] = clocks;
+		eventPlace(eventCount, id);
+		eventSiftUp(eventCount++);
+	}
+
+	eventUpdateNext();
+}
+
+void eventCancel(unsigned int id) {
+	if (!eventSlot[id])
+		return;
+
+	const unsigned int slot = eventSlot[id] - 1;
+	eventSlot[id] = 0;
+	eventCount--;
+
+	// fill the hole with the last entry
+	if (slot != eventCount) {
+		const unsigned int last = eventHeap[eventCount];
+		eventPlace(slot, last);
+		eventSiftUp(slot);
+		eventSiftDown(eventSlot[last] - 1);
+	}
+
+	eventUpdateNext();
+}
+
+// clocks for a whole byte with the internal clock, 8192 Hz (or 262144 Hz with the CGB fast clock bit) per bit
+static unsigned int serialTransferClocks() {
+	return (cgb.isCGB && (cpu.memory.SC_serial_ctl & 0x02)) ? 8 * 16 : 8 * 512;
+}
+
+void serialStart() {
+	eventSchedule(EVENT_SERIAL, cpu.clocks + serialTransferClocks());
+}
+
+// serial transfers never have another gameboy on the other end, so 0xFF is "received"
+static void serialComplete() {
+	cpu.memory.SB_serial_data = 0xFF;
+	cpu.memory.SC_serial_ctl &= 0x7F;
+	cpu.memory.IF_intflag |= INTERRUPTS_SERIAL;
+}
+
+void eventDispatch() {
+	while (eventNextClock <= cpu.clocks) {
+		const unsigned int id = eventHeap[0];
+		eventCancel(id);
+
+		switch (id) {
+			case EVENT_GPU:
+				gpuStep();
+				eventSchedule(EVENT_GPU, cpu.gpuTick);
+				break;
+			case EVENT_TIMER:
+				// sets the interrupt flag and schedules the next overflow
+				updateTimer();
+				break;
+			case EVENT_SERIAL:
+				serialComplete();
+				break;
+			case EVENT_INTERRUPT:
+				break;
+		}
+	}
+
+	if (interruptCheck()) interruptStep();
+
+	// memory may have changed, busy wait loops have to be checked again
+	cpuIdleLoopReset();
+}
+
+void eventRebase(unsigned int amount) {
+	// same offset for everything so the heap order holds
+	for (unsigned int i = 0; i < eventCount; i++) {
+		eventClocks[eventHeap[i]] -= amount;
+	}
+
+	eventUpdateNext();
+}
+
+void eventReset() {
+	for (int i = 0; i < EVENT_MAX; i++) {
+		eventSlot[i] = 0;
+	}
+	eventCount = 0;
+
+	eventSchedule(EVENT_GPU, cpu.gpuTick);
+	if (cpu.timerInterrupt != 0xFFFFFFFF) {
+		eventSchedule(EVENT_TIMER, cpu.timerInterrupt);
+	}
+	if ((cpu.memory.SC_serial_ctl & 0x81) == 0x81) {
+		serialStart();
+	}
+	eventInterruptChanged();
+	cpuIdleLoopReset();
+}
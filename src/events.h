@@ -0,0 +1,41 @@
+#pragma once
+
+#include "cpu.h"
+
+// Event scheduler, everything that happens at a given cpu clock (gpu mode changes, timer overflow, etc) is an event
+// and the cpu runs instructions until the next one is due. Kept as a small min heap keyed on cpu.clocks.
+
+enum cpu_event {
+	EVENT_GPU = 0,					// next gpu mode transition at cpu.gpuTick (also drives hblank DMA, RTC and sound updates)
+	EVENT_TIMER,					// TIMA overflow at cpu.timerInterrupt
+	EVENT_SERIAL,					// serial transfer started with the internal clock completes
+	EVENT_INTERRUPT,				// interrupt or halt state changed, stops the cpu so pending interrupts are checked
+
+	EVENT_MAX
+};
+
+// clock of the soonest event, 0xFFFFFFFF if nothing is scheduled
+extern unsigned int eventNextClock;
+
+// schedules (or reschedules) the given event
+void eventSchedule(unsigned int id, unsigned int clocks);
+
+// removes the event if it is scheduled
+void eventCancel(unsigned int id);
+
+// runs every event that is due at cpu.clocks, in clock order
+void eventDispatch();
+
+// moves all event times back by the given amount along with cpu.clocks
+void eventRebase(unsigned int amount);
+
+// rebuilds the scheduled events from the cpu state (reset, save state load)
+void eventReset();
+
+// starts a serial transfer with the internal clock, it completes as an EVENT_SERIAL
+void serialStart();
+
+// stops the cpu loop after the current instruction (EI, RETI, HALT, interrupt flag writes)
+inline void eventInterruptChanged() {
+	eventSchedule(EVENT_INTERRUPT, cpu.clocks);
+}
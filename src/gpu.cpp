@@ -9,13 +9,18 @@
 #include "emulator.h"
 
 #include "gpu.h"
+#include "events.h"
 #include "snd/snd.h"
 #include "keys.h"
 
+#include "tilerow.inl"
+
 void(*gpuStep)(void) = NULL;
 
 int windowLineOffset = 0;
 
+PPU_LOCAL gpu_lineregs gpuLineRegs = { 0 };
+
 unsigned int ppuPalette[64] = { 0 };
 
 unsigned int gpuTimes[5] = {
@@ -40,6 +45,10 @@ void stepLCDOff(void) {
 		// good time for sound update
 		condSoundUpdate();
 
+		// and to read ahead the next rom bank or save battery RAM
+		mbcPrefetch();
+		mbcSaveTick();
+
 		// good time to refresh the keys
 		refreshKeys(true);
 
@@ -76,16 +85,49 @@ static inline void SetLY(unsigned int ly) {
 	condSoundUpdate();
 }
 
-void stepLCDOn_OAM(void) {
-	// we can force a step to avoid just spinning wheels when halted:
-	if (cpu.halted && cpu.IME) {
-		// don't screw up the timer or overcompensate
-		if (cpu.clocks < cpu.gpuTick && cpu.timerInterrupt > cpu.gpuTick) {
-			cpu.clocks += cpu.gpuTick - cpu.clocks;
-			cpu.gpuTick = cpu.clocks;
-		}
+#if CATCHUP_PPU
+// the current line is past mode 3, it is rendered with the next batch (or right away by the PPU thread)
+static inline void linePassed() {
+#if PPU_THREAD
+	gpuThreadPush();
+#else
+#if PARALLEL_LINES
+	gpuCaptureLineRegs(gpuPassedLineRegs[cpu.memory.LY_lcdline]);
+#endif
+	if (!gpuPendingLines.count) {
+		gpuPendingLines.first = cpu.memory.LY_lcdline;
+	}
+	gpuPendingLines.count++;
+#endif
+}
+#endif
+
+#if LAZY_STAT
+gpu_linemodestats gpuLineModeStats = { 0 };
+
+// whether the current fast line was added to the pending lines yet
+static bool fastLinePassed = false;
+
+static inline bool fastLinesAllowed() {
+	return (cpu.memory.STAT_lcdstatus & (STAT_LYCCHECK | STAT_OAMCHECK | STAT_VBLANKCHECK | STAT_HBLANKCHECK)) == 0 && !cgb.hblankDmaActive;
+}
+#endif
+
+// starts mode 2 of a visible line, as a single event if nothing needs the mode transitions
+static inline void startLine() {
+#if LAZY_STAT
+	if (fastLinesAllowed()) {
+		fastLinePassed = false;
+		gpuLineModeStats.fastLines++;
+		setMode(GPU_MODE_OAM, gpuTimes[GPU_MODE_OAM] + gpuTimes[GPU_MODE_VRAM] + gpuTimes[GPU_MODE_HBLANK], stepLCDOn_LINE);
+		return;
 	}
+	gpuLineModeStats.fullLines++;
+#endif
+	setMode(GPU_MODE_OAM, gpuTimes[GPU_MODE_OAM], stepLCDOn_OAM);
+}
 
+void stepLCDOn_OAM(void) {
 	if (cpu.clocks >= cpu.gpuTick) {
 		setMode(GPU_MODE_VRAM, gpuTimes[GPU_MODE_VRAM], stepLCDOn_VRAM);
 	}
@@ -94,18 +136,15 @@ void stepLCDOn_OAM(void) {
 void stepLCDOn_VRAM(void) {
 	TIME_SCOPE();
 
-	// we can force a step to avoid just spinning wheels when halted:
-	if (cpu.halted && cpu.IME) {
-		// don't screw up the timer or overcompensate
-		if (cpu.clocks < cpu.gpuTick && cpu.timerInterrupt > cpu.gpuTick) {
-			cpu.clocks += cpu.gpuTick - cpu.clocks;
-			cpu.gpuTick = cpu.clocks;
-		}
-	}
-
 	if (cpu.clocks >= cpu.gpuTick) {
-		if (!invalidFrame)
+		if (!invalidFrame) {
+#if CATCHUP_PPU
+			linePassed();
+#else
+			gpuCaptureLineRegs(gpuLineRegs);
 			renderScanline();
+#endif
+		}
 
 		// past LYC check ignores hblank check
 		if ((cpu.memory.STAT_lcdstatus & STAT_HBLANKCHECK) &&
@@ -124,19 +163,12 @@ void stepLCDOn_VRAM(void) {
 void stepLCDOn_HBLANK(void) {
 	TIME_SCOPE();
 
-	// we can force a step to avoid just spinning wheels when halted:
-	if (cpu.halted && cpu.IME) {
-		// don't screw up the timer or overcompensate
-		if (cpu.clocks < cpu.gpuTick && cpu.timerInterrupt > cpu.gpuTick) {
-			cpu.clocks += cpu.gpuTick - cpu.clocks;
-			cpu.gpuTick = cpu.clocks;
-		}
-	}
-
 	if (cpu.clocks >= cpu.gpuTick) {
 		SetLY(cpu.memory.LY_lcdline + 1);
 
 		if (cpu.memory.LY_lcdline == 144) {
+			gpuCatchUp();
+
 			ScopeTimer::ReportFrame();
 
 			if (drawFramebuffer && !invalidFrame) {
@@ -144,6 +176,12 @@ void stepLCDOn_HBLANK(void) {
 			}
 			cpu.memory.IF_intflag |= INTERRUPTS_VBLANK;
 
+			// games mostly wait out vblank, read ahead the next rom bank
+			mbcPrefetch();
+
+			// and save battery RAM that has settled
+			mbcSaveTick();
+
 			// joypad interrupt here (though I don't think many games used it)
 			if (!cgb.isCGB && (cpu.halted || cpu.stopped || cpu.memory.IE_intenable & INTERRUPTS_JOYPAD)) {
 				unsigned char jPad = readByteSpecial(0xFF00);
@@ -170,21 +208,12 @@ void stepLCDOn_HBLANK(void) {
 				cpu.memory.IF_intflag |= INTERRUPTS_LCDSTAT;
 			}
 
-			setMode(GPU_MODE_OAM, gpuTimes[GPU_MODE_OAM], stepLCDOn_OAM);
+			startLine();
 		}
 	}
 }
 
 void stepLCDOn_VBLANK(void) {
-	// we can force a step to avoid just spinning wheels when halted:
-	if (cpu.halted && cpu.IME) {
-		// don't screw up the timer or overcompensate
-		if (cpu.clocks < cpu.gpuTick && cpu.timerInterrupt > cpu.gpuTick) {
-			cpu.clocks += cpu.gpuTick - cpu.clocks;
-			cpu.gpuTick = cpu.clocks;
-		}
-	}
-
 	if (cpu.clocks >= cpu.gpuTick) {
 		switch (cpu.memory.LY_lcdline) {
 			case 0x00:
@@ -195,15 +224,10 @@ void stepLCDOn_VBLANK(void) {
 					sndInactiveFrame();
 				}
 
-				// check for dirty rtc value once per frame
-				if (mbcIsRTC()) {
-					rtcCheckDirty();
-				}
-
 				// check if lcd was disabled:
 				if (cpu.memory.LCDC_ctl & 0x80) {
 					invalidFrame = false;
-					setMode(GPU_MODE_OAM, gpuTimes[GPU_MODE_OAM], stepLCDOn_OAM);
+					startLine();
 
 					// vlank check disables stat OAM interrupt
 					if ((cpu.memory.STAT_lcdstatus & STAT_OAMCHECK) && !(cpu.memory.STAT_lcdstatus & STAT_VBLANKCHECK)) {
@@ -211,11 +235,11 @@ void stepLCDOn_VBLANK(void) {
 					}
 				} else {
 					//  LCD was disabled, but first draw the blank result
+					gpuCaptureLineRegs(gpuLineRegs);
 					for (int i = 0; i < 144; i++) {
-						cpu.memory.LY_lcdline = i;
+						gpuLineRegs.line = i;
 						renderBlankScanline();
 					}
-					cpu.memory.LY_lcdline = 0;
 					drawFramebuffer();
 
 					// send one hblank dma off if there is one
@@ -243,8 +267,380 @@ void stepLCDOn_VBLANK(void) {
 	}
 }
 
+#if LAZY_STAT
+void stepLCDOn_LINE(void) {
+	if (cpu.clocks >= cpu.gpuTick) {
+		gpuFastLineSync();
+
+		// the end of the line is the same as at the end of hblank
+		stepLCDOn_HBLANK();
+	}
+}
+
+void gpuFastLineSync() {
+	if (!fastLinePassed && gpuLCDMode() == GPU_MODE_HBLANK) {
+		fastLinePassed = true;
+		if (!invalidFrame) {
+			linePassed();
+		}
+	}
+}
+
+void gpuLeaveFastLine() {
+	if (!gpuFastLine())
+		return;
+
+	gpuFastLineSync();
+
+	const unsigned int mode = gpuLCDMode();
+	SET_LCDC_MODE(mode);
+	switch (mode) {
+		case GPU_MODE_OAM:
+			gpuStep = stepLCDOn_OAM;
+			cpu.gpuTick -= gpuTimes[GPU_MODE_VRAM] + gpuTimes[GPU_MODE_HBLANK];
+			break;
+		case GPU_MODE_VRAM:
+			gpuStep = stepLCDOn_VRAM;
+			cpu.gpuTick -= gpuTimes[GPU_MODE_HBLANK];
+			break;
+		default:
+			gpuStep = stepLCDOn_HBLANK;
+			break;
+	}
+	eventSchedule(EVENT_GPU, cpu.gpuTick);
+}
+
+void gpuOnStateLoad() {
+	if (!gpuFastLine())
+		return;
+
+	switch (GET_LCDC_MODE()) {
+		case GPU_MODE_OAM: gpuStep = stepLCDOn_OAM; break;
+		case GPU_MODE_VRAM: gpuStep = stepLCDOn_VRAM; break;
+		case GPU_MODE_HBLANK: gpuStep = stepLCDOn_HBLANK; break;
+		default: gpuStep = stepLCDOn_VBLANK; break;
+	}
+}
+#endif
+
+#if CATCHUP_PPU
+gpu_pendinglines gpuPendingLines = { 0 };
+gpu_catchupstats gpuCatchUpStats = { 0 };
+
+void gpuRenderPendingLines() {
+	TIME_SCOPE();
+
+#if PARALLEL_LINES
+	gpuRenderParallel(gpuPendingLines.first, gpuPendingLines.count);
+#else
+	// nothing the pending lines are drawn from has changed since they were passed
+	gpuCaptureLineRegs(gpuLineRegs);
+	for (int i = 0; i < gpuPendingLines.count; i++) {
+		gpuLineRegs.line = gpuPendingLines.first + i;
+		renderScanline();
+	}
+#endif
+
+	gpuCatchUpStats.batches++;
+	gpuCatchUpStats.lines += gpuPendingLines.count;
+	gpuPendingLines.count = 0;
+}
+#endif
+
+#if SPRITE_LISTS
+gpu_spriteline spriteLines[144];
+bool spriteListsDirty = true;
+
+void buildSpriteLists() {
+	const int spriteSize = (cpu.memory.LCDC_ctl & LCDC_SPRITEVDOUBLE) ? 16 : 8;
+
+	for (int i = 0; i < 144; i++) {
+		spriteLines[i].count = 0;
+	}
+
+	// the first 10 sprites in OAM on a line are the ones shown, even the ones off the sides of the screen count
+	const sprite_type* sprites = (const sprite_type*) oam;
+	for (int i = 0; i < 40; i++) {
+		const int sy = sprites[i].y - 16;
+		const int last = min(sy + spriteSize, 144);
+		for (int line = max(sy, 0); line < last; line++) {
+			gpu_spriteline& spriteLine = spriteLines[line];
+			if (spriteLine.count < 10) {
+				spriteLine.sprites[spriteLine.count++] = i;
+			}
+		}
+	}
+
+	// sort into drawing order, the highest priority sprite last. Lower OAM index is higher priority, and on DMG the
+	// smaller x position comes first
+	for (int line = 0; line < 144; line++) {
+		gpu_spriteline& spriteLine = spriteLines[line];
+		for (int i = 1; i < spriteLine.count; i++) {
+			const int index = spriteLine.sprites[i];
+			const int x = cgb.isCGB ? 0 : sprites[index].x;
+
+			int j = i;
+			for (; j > 0; j--) {
+				const int otherIndex = spriteLine.sprites[j - 1];
+				const int otherX = cgb.isCGB ? 0 : sprites[otherIndex].x;
+				if (otherX > x || (otherX == x && otherIndex > index)) break;
+				spriteLine.sprites[j] = otherIndex;
+			}
+			spriteLine.sprites[j] = index;
+		}
+	}
+
+	spriteListsDirty = false;
+}
+#endif
+
+#if DIRTY_LINES
+gpu_generations gpuGenerations = { 0 };
+PPU_LOCAL gpu_linestats gpuLineStats = { 0 };
+
+// everything a line is drawn from, as of when it was last rendered
+struct gpu_linesignature {
+	unsigned char lcdc;
+	unsigned char scx;
+	unsigned char scy;
+	unsigned char wx;
+	unsigned char wy;
+	unsigned char bgp;
+	unsigned char obp0;
+	unsigned char obp1;
+	int windowLine;
+	unsigned int bgRow;
+	unsigned int windowRow;
+	unsigned int tiles;
+	unsigned int oam;
+	unsigned int palette;
+};
+
+static gpu_linesignature lineSignatures[144];
+static bool lineValid[144] = { false };
+static bool lineChanged[144] = { false };
+
+bool gpuLineNeedsRender(bool pairedLines) {
+	const int line = gpuLineRegs.line;
+
+	gpu_linesignature signature;
+	signature.lcdc = gpuLineRegs.lcdc;
+	signature.scx = gpuLineRegs.scx;
+	signature.scy = gpuLineRegs.scy;
+	signature.wx = gpuLineRegs.wx;
+	signature.wy = gpuLineRegs.wy;
+	signature.bgp = gpuLineRegs.bgp;
+	signature.obp0 = gpuLineRegs.obp0;
+	signature.obp1 = gpuLineRegs.obp1;
+	signature.windowLine = gpuLineRegs.windowLine;
+
+	const unsigned int bgRow = ((gpuLineRegs.lcdc & LCDC_BGTILEMAP) ? 32 : 0) + (((line + gpuLineRegs.scy) & 255) >> 3);
+	signature.bgRow = gpuGenerations.mapRows[bgRow];
+
+	// window rows past the end of the map read past it, those lines are always rendered
+	const int windowY = line - gpuLineRegs.wy + gpuLineRegs.windowLine;
+	bool valid = lineValid[line];
+	signature.windowRow = 0;
+	if ((gpuLineRegs.lcdc & LCDC_WINDOWENABLE) && windowY >= 0) {
+		if (windowY < 256) {
+			signature.windowRow = gpuGenerations.mapRows[((gpuLineRegs.lcdc & LCDC_WINDOWTILEMAP) ? 32 : 0) + (windowY >> 3)];
+		} else {
+			valid = false;
+		}
+	}
+
+	signature.tiles = gpuGenerations.tiles;
+	signature.oam = gpuGenerations.oam;
+	signature.palette = gpuGenerations.palette;
+
+	const bool changed = !valid || memcmp(&signature, &lineSignatures[line], sizeof(signature)) != 0;
+	lineChanged[line] = changed;
+	if (changed) {
+		lineSignatures[line] = signature;
+		lineValid[line] = true;
+	}
+
+	bool needsRender = changed;
+	if (pairedLines && !changed) {
+		needsRender = (line & 1) == 0 || lineChanged[line - 1];
+	}
+
+	if (needsRender) {
+		gpuLineStats.linesRendered++;
+	} else {
+		gpuLineStats.linesSkipped++;
+	}
+	return needsRender;
+}
+
+bool gpuLineDirty(int line) {
+	return lineChanged[line];
+}
+
+void gpuBlankLine() {
+	lineValid[gpuLineRegs.line] = false;
+	lineChanged[gpuLineRegs.line] = true;
+}
+
+void gpuInvalidateLines() {
+	memset(lineValid, 0, sizeof(lineValid));
+}
+#endif
+
 void SetupDisplayPalette() {
 	resolveDMGBGPalette();
 	resolveDMGOBJ0Palette();
 	resolveDMGOBJ1Palette();
-}
\ No newline at end of file
+	gpuInvalidateLines();
+}
+
+#if TILE_CACHE
+unsigned char* tileCache = NULL;
+
+// 384 tiles of 8 rows per bank
+#define TILE_CACHE_BANK_SIZE (384 * 8 * 16)
+
+static inline void decodeTileRow(unsigned int offset) {
+	unsigned int tileRow = *((unsigned short*)&vram[offset]);
+	ShortSwap(tileRow);
+
+	unsigned char* row = tileCacheRow(offset);
+	resolveTileRow<false>(row, tileRow);
+	resolveTileRowReverse<false>(row + 8, tileRow);
+}
+
+#if BG_SURFACE
+gpu_bgsurface* bgSurface = NULL;
+unsigned int vramGeneration = 1;
+
+// tile number of the tile data at the given VRAM offset, + 384 for CGB bank 1
+static inline unsigned int tileNumber(unsigned int offset) {
+	return ((offset & 0x1FFF) >> 4) + (offset >> 13) * 384;
+}
+#endif
+
+void tileCacheReset(bool isCGB) {
+	tileCacheFree();
+
+	// cleared VRAM decodes to all zero pixels. Without the heap for it the renderers decode the rows from VRAM
+	const unsigned int size = isCGB ? TILE_CACHE_BANK_SIZE * 2 : TILE_CACHE_BANK_SIZE;
+	tileCache = (unsigned char*) malloc(size);
+	if (!tileCache)
+		return;
+	memset(tileCache, 0, size);
+
+#if BG_SURFACE
+	// every tile gets drawn the first time its row is used, the tiles are drawn a row at a time without it
+	bgSurface = (gpu_bgsurface*) malloc(sizeof(gpu_bgsurface));
+	if (bgSurface) {
+		memset(bgSurface, 0, sizeof(gpu_bgsurface));
+		memset(bgSurface->cellTile, 0xFF, sizeof(bgSurface->cellTile));
+	}
+	vramGeneration = 1;
+#endif
+}
+
+void tileCacheFree() {
+	if (tileCache) {
+		free((void*)tileCache);
+		tileCache = NULL;
+	}
+
+#if BG_SURFACE
+	if (bgSurface) {
+		free((void*)bgSurface);
+		bgSurface = NULL;
+	}
+#endif
+}
+#endif
+
+#if VRAM_WRITE_TRACKING
+// a tile data or tile map byte at the given VRAM offset changed
+static inline void vramChanged(unsigned int offset) {
+	if ((offset & 0x1FFF) < 0x1800) {
+#if TILE_CACHE
+		if (tileCache) {
+			decodeTileRow(offset & ~1);
+		}
+#endif
+#if BG_SURFACE
+		if (bgSurface) {
+			bgSurface->tileGeneration[tileNumber(offset)]++;
+		}
+#endif
+#if DIRTY_LINES
+		gpuGenerations.tiles++;
+#endif
+	} else {
+#if DIRTY_LINES
+		gpuGenerations.mapRows[((offset & 0x1FFF) - 0x1800) >> 5]++;
+#endif
+	}
+
+#if BG_SURFACE
+	vramGeneration++;
+#endif
+}
+
+void gpuVRAMChanged(unsigned int offset, unsigned int length) {
+	for (unsigned int i = offset & ~1; i < offset + length; i += 2) {
+		vramChanged(i);
+	}
+}
+
+void gpuWriteVRAM(unsigned int address, unsigned char value) {
+	unsigned char* host = &readMap[address >> 8][address & 0xFF];
+#if CATCHUP_PPU
+	if (*host == value) {
+		return;
+	}
+	gpuCatchUp();
+#endif
+	*host = value;
+	cpuPageTouched(address >> 8);
+
+	vramChanged(host - vram);
+}
+#endif
+
+#if BG_SURFACE
+void bgSurfaceRefreshRow(unsigned int row) {
+	const unsigned int mapOffset = 0x1800 + (row << 5);
+	const int tileOffset = (gpuLineRegs.lcdc & LCDC_TILESET) ? 0 : 256;
+	unsigned char* pixels = &bgSurface->pixels[row >> 5][(row & 31) << 11];
+
+	bool priority = false;
+	for (unsigned int i = 0; i < 32; i++, pixels += 8) {
+		int tile = vram[mapOffset + i];
+		if (!(tile & 0x80)) tile += tileOffset;
+
+		// attribute bit 3 is vram bank number, bit 7 is BG priority
+		const int attr = cgb.isCGB ? vram[mapOffset + i + 0x2000] : 0;
+		const int bank = (attr & 0x08) >> 3;
+		priority |= (attr & 0x80) != 0;
+
+		const unsigned int cell = (row << 5) + i;
+		const unsigned int number = tile + bank * 384;
+		if (bgSurface->cellTile[cell] == number && bgSurface->cellAttr[cell] == attr &&
+			bgSurface->cellGeneration[cell] == bgSurface->tileGeneration[number]) {
+			continue;
+		}
+
+		bgSurface->cellTile[cell] = number;
+		bgSurface->cellAttr[cell] = attr;
+		bgSurface->cellGeneration[cell] = bgSurface->tileGeneration[number];
+
+		// attribute bit 0-2 is bg palette, bit 5 is hflip, bit 6 is yflip
+		const int paletteMask = (attr & 0x07) << 4;
+		const int flipOffset = (attr & 0x20) ? 8 : 0;
+		for (int y = 0; y < 8; y++) {
+			const int tileY = (attr & 0x40) ? 7 - y : y;
+			copyTileRowPal<false>(paletteMask, pixels + (y << 8), tileCacheRow(tile * 16 + tileY * 2 + (bank << 13)) + flipOffset);
+		}
+	}
+
+	bgSurface->rowPriority[row] = priority;
+	bgSurface->rowGeneration[row] = vramGeneration;
+}
+#endif
@@ -34,10 +34,6 @@ extern unsigned int gpuTimes[5];
 #define SET_LCDC_MODE(x) cpu.memory.STAT_lcdstatus = (cpu.memory.STAT_lcdstatus & 0xFC) | (x)
 #define GET_LCDC_MODE() (cpu.memory.STAT_lcdstatus & STAT_MODE)
 
-inline bool gpuCheck() {
-	return (cpu.clocks >= cpu.gpuTick || (cpu.halted && cpu.IME));
-}
-
 struct sprite_type {
 	unsigned char y;
 	unsigned char x;
@@ -59,6 +55,7 @@ extern void stepLCDOn_OAM(void);
 extern void stepLCDOn_VRAM(void);
 extern void stepLCDOn_HBLANK(void);
 extern void stepLCDOn_VBLANK(void);
+extern void stepLCDOn_LINE(void);
 
 // shared color palette (the colors are two pixels wide to make stretching code faster)
 extern unsigned int ppuPalette[64];
@@ -72,9 +69,417 @@ extern unsigned int framecounter;
 // used to resolve window render error on a few games
 extern int windowLineOffset;
 
-// line buffer rendered too during scanline render functions
-const int lineBufferSize = 180;
-extern unsigned char* lineBuffer;
+// on the host build, catch-up batches are drawn by a small pool of render threads. Each line keeps the registers it was
+// passed with, so scroll and window position writes don't end a batch and frames with raster effects are still drawn
+// in one go at vblank. The lines are handed out a few pairs at a time to whichever thread is free (the scaled display
+// modes blend each odd line with the even line before it), short batches are drawn on the cpu thread. Output is the
+// same as drawing the lines one by one. Needs CATCHUP_PPU and TARGET_LINUX but not PPU_THREAD, off by default, can be
+// overridden by defining PARALLEL_LINES as 0 or 1
+#ifndef PARALLEL_LINES
+#define PARALLEL_LINES 0
+#endif
+
+// state the renderers write while drawing a line is per thread with PARALLEL_LINES
+#if PARALLEL_LINES
+#define PPU_LOCAL __thread
+#else
+#define PPU_LOCAL
+#endif
+
+// the registers a line is drawn with. The renderers and display drivers read these instead of the live registers, the
+// line may be drawn after LY and the registers have moved on (catch-up batches, the PPU thread)
+struct gpu_lineregs {
+	unsigned char line;
+	unsigned char lcdc;
+	unsigned char scx;
+	unsigned char scy;
+	unsigned char wx;
+	unsigned char wy;
+	unsigned char bgp;
+	unsigned char obp0;
+	unsigned char obp1;
+	int windowLine;
+};
+
+// registers of the line being drawn
+extern PPU_LOCAL gpu_lineregs gpuLineRegs;
+
+// the current line (LY) with the registers as they are now
+inline void gpuCaptureLineRegs(gpu_lineregs& regs) {
+	regs.line = cpu.memory.LY_lcdline;
+	regs.lcdc = cpu.memory.LCDC_ctl;
+	regs.scx = cpu.memory.SCX_bgscrollx;
+	regs.scy = cpu.memory.SCY_bgscrolly;
+	regs.wx = cpu.memory.WX_windowx;
+	regs.wy = cpu.memory.WY_windowy;
+	regs.bgp = cpu.memory.BGP_bgpalette;
+	regs.obp0 = cpu.memory.OBP0_spritepal0;
+	regs.obp1 = cpu.memory.OBP1_spritepal1;
+	regs.windowLine = windowLineOffset;
+}
+
+// line buffer rendered too during scanline render functions (the last window tile can end at pixel 182 with the
+// 7 pixel scroll offset)
+const int lineBufferSize = 184;
+extern PPU_LOCAL unsigned char* lineBuffer;
+
+// keeps every tile row decoded to its 8 palette ready pixels (and X flipped) as the tile data is written, so the
+// scanline renderers copy rows instead of resolving the bits. Needs 48k per VRAM bank. Can be overridden by defining
+// TILE_CACHE as 0 or 1
+#ifndef TILE_CACHE
+#define TILE_CACHE 1
+#endif
+
+#if TILE_CACHE
+// 16 bytes per tile row, the 8 pixels followed by the same row X flipped. Bank 1 rows follow bank 0's on CGB
+extern unsigned char* tileCache;
+
+// allocates the cache for newly allocated (cleared) VRAM
+void tileCacheReset(bool isCGB);
+void tileCacheFree();
+
+// cached row for a VRAM offset into the tile data (tile * 16 + y * 2, + 0x2000 for CGB bank 1)
+inline unsigned char* tileCacheRow(unsigned int offset) {
+	return &tileCache[((offset & 0x1FFE) + (offset >> 13) * 0x1800) << 3];
+}
+#endif
+
+// keeps both tile maps drawn to 256x256 surfaces of palette ready pixels, so the background and window are copied
+// a line at a time instead of drawn a tile at a time. Map rows are only drawn again after VRAM or the tile set
+// changes, and only the tiles that changed. Needs the tile cache and 128k more, off by default. Can be overridden by
+// defining BG_SURFACE as 0 or 1
+#ifndef BG_SURFACE
+#define BG_SURFACE 0
+#endif
+
+#if BG_SURFACE
+#if !TILE_CACHE
+#error BG_SURFACE needs TILE_CACHE
+#endif
+
+struct gpu_bgsurface {
+	unsigned char pixels[2][256 * 256];			// one surface for each tile map
+
+	// map rows (32 per map) are up to date if drawn at the current vramGeneration, the CGB priority renderer is
+	// still needed for rows with BG priority tiles
+	unsigned int rowGeneration[64];
+	bool rowPriority[64];
+
+	// what each map entry was drawn with
+	unsigned short cellTile[2048];				// tile number, + 384 for CGB bank 1
+	unsigned char cellAttr[2048];				// CGB attributes
+	unsigned int cellGeneration[2048];			// tileGeneration of the tile when it was drawn
+
+	unsigned int tileGeneration[768];			// bumped when a tile's data is written, both banks
+};
+
+extern gpu_bgsurface* bgSurface;
+
+// bumped for every VRAM write and tile set change
+extern unsigned int vramGeneration;
+
+// draws the tiles in the given map row (map * 32 + y / 8) that changed since it was last drawn
+void bgSurfaceRefreshRow(unsigned int row);
+
+// pixel line y of the surface for the given tile map (0 for 0x9800, 1 for 0x9C00)
+inline const unsigned char* bgSurfaceLine(unsigned int map, unsigned int y) {
+	const unsigned int row = map * 32 + (y >> 3);
+	if (bgSurface->rowGeneration[row] != vramGeneration) {
+		bgSurfaceRefreshRow(row);
+	}
+	return &bgSurface->pixels[map][y << 8];
+}
+
+// whether the map row at the given surface line has CGB BG priority tiles
+inline bool bgSurfaceLinePriority(unsigned int map, unsigned int y) {
+	return bgSurface->rowPriority[map * 32 + (y >> 3)];
+}
+
+// copies count pixels from a surface line starting at x, wrapping around at the surface edge
+inline void bgSurfaceCopy(unsigned char* scanline, const unsigned char* line, unsigned int x, unsigned int count) {
+	const unsigned int first = min(count, 256 - x);
+	memcpy(scanline, line + x, first);
+	if (first < count) {
+		memcpy(scanline + first, line, count - first);
+	}
+}
+#endif
+
+// lines are only rendered (and sent to the LCD) again when something they are drawn from changed since the last frame:
+// the tile map rows they show, the tile data, OAM, palettes and the registers as of that line. Can be overridden by
+// defining DIRTY_LINES as 0 or 1
+#ifndef DIRTY_LINES
+#define DIRTY_LINES 1
+#endif
+
+// lines are rendered in batches instead of as the LCD reaches them. Lines the LCD has passed are pending until vblank,
+// or until a write is about to change what they are drawn from (display registers, VRAM, OAM, palettes), so frames
+// without mid frame effects render all 144 lines in one go. Can be overridden by defining CATCHUP_PPU as 0 or 1
+#ifndef CATCHUP_PPU
+#define CATCHUP_PPU 1
+#endif
+
+#if CATCHUP_PPU
+struct gpu_pendinglines {
+	int first;
+	int count;
+};
+
+extern gpu_pendinglines gpuPendingLines;
+
+struct gpu_catchupstats {
+	unsigned int batches;
+	unsigned int lines;
+};
+
+extern gpu_catchupstats gpuCatchUpStats;
+
+void gpuRenderPendingLines();
+#endif
+
+// while no STAT interrupts are enabled (and no hblank DMA is running), each visible line is a single gpu event instead
+// of one per mode. LY still moves with it, the STAT mode bits are worked out from the clocks left in the line when
+// read, and the line is pending for catch-up rendering from the point mode 3 would have ended. Enabling a STAT
+// interrupt goes back to stepping through the modes mid line. Needs CATCHUP_PPU, can be overridden by defining
+// LAZY_STAT as 0 or 1
+#ifndef LAZY_STAT
+#define LAZY_STAT CATCHUP_PPU
+#endif
+
+#if LAZY_STAT
+#if !CATCHUP_PPU
+#error LAZY_STAT needs CATCHUP_PPU
+#endif
+
+struct gpu_linemodestats {
+	unsigned int fastLines;
+	unsigned int fullLines;
+};
+
+extern gpu_linemodestats gpuLineModeStats;
+
+// whether the current line is a single event with the mode bits out of date
+inline bool gpuFastLine() {
+	return gpuStep == stepLCDOn_LINE;
+}
+
+// adds the current line to the pending lines once it is past mode 3
+void gpuFastLineSync();
+
+// goes back to the mode transitions for the rest of the current line (STAT writes, hblank DMA, save states)
+void gpuLeaveFastLine();
+
+// current mode, as the STAT mode bits would be
+inline unsigned int gpuLCDMode() {
+	if (gpuFastLine()) {
+		// can be past the end of the line until the event runs
+		const int remaining = (int) (cpu.gpuTick - cpu.clocks);
+		if (remaining > (int) (gpuTimes[GPU_MODE_HBLANK] + gpuTimes[GPU_MODE_VRAM])) return GPU_MODE_OAM;
+		if (remaining > (int) gpuTimes[GPU_MODE_HBLANK]) return GPU_MODE_VRAM;
+		return GPU_MODE_HBLANK;
+	}
+	return GET_LCDC_MODE();
+}
+
+// clock the mode changes at next after the given one, there is no event for it during a fast line
+inline unsigned int gpuNextModeClock(unsigned int fromClock) {
+	if (gpuFastLine()) {
+		const int remaining = (int) (cpu.gpuTick - fromClock);
+		if (remaining > (int) (gpuTimes[GPU_MODE_HBLANK] + gpuTimes[GPU_MODE_VRAM])) return cpu.gpuTick - gpuTimes[GPU_MODE_HBLANK] - gpuTimes[GPU_MODE_VRAM];
+		if (remaining > (int) gpuTimes[GPU_MODE_HBLANK]) return cpu.gpuTick - gpuTimes[GPU_MODE_HBLANK];
+	}
+	return cpu.gpuTick;
+}
+
+// picks the step for the mode bits of a loaded state, which never has fast lines
+void gpuOnStateLoad();
+#else
+inline unsigned int gpuLCDMode() { return GET_LCDC_MODE(); }
+inline void gpuLeaveFastLine() {}
+inline void gpuOnStateLoad() {}
+#endif
+
+// on the host build, the lines are drawn on a worker thread. Each line is handed over as soon as it is passed along with
+// the registers it is drawn with, through a single producer / single consumer ring, and the cpu thread keeps going.
+// The catch-up points become the places the cpu waits for the worker to finish, so VRAM, OAM, palettes and LCDC stay
+// as the worker's lines need them, while the scroll and window position registers don't have to wait at all. Needs
+// CATCHUP_PPU and TARGET_LINUX, off by default, can be overridden by defining PPU_THREAD as 0 or 1
+#ifndef PPU_THREAD
+#define PPU_THREAD 0
+#endif
+
+#if PPU_THREAD
+#if !CATCHUP_PPU || !TARGET_LINUX
+#error PPU_THREAD needs CATCHUP_PPU and the host build
+#endif
+
+struct gpu_threadstats {
+	unsigned int lines;
+	unsigned int waits;						// catch-up points the worker still had lines to draw at
+	unsigned int sleeps;					// waits long enough to block the cpu thread
+};
+
+extern gpu_threadstats gpuThreadStats;
+
+// hands the current line to the worker with the registers as they are now, the worker starts with the first line
+void gpuThreadPush();
+
+// waits until the worker has drawn every line it was given
+void gpuThreadWait();
+#endif
+
+#if PARALLEL_LINES
+#if !CATCHUP_PPU || !TARGET_LINUX || PPU_THREAD
+#error PARALLEL_LINES needs CATCHUP_PPU and the host build, and not PPU_THREAD
+#endif
+
+struct gpu_parallelstats {
+	unsigned int batches;					// batches long enough to be split across the render threads
+	unsigned int lines;
+};
+
+extern gpu_parallelstats gpuParallelStats;
+
+// render threads, counting the cpu thread. 0 (the default) is one per core, 1 draws every batch on the cpu thread. Read
+// when the first batch is drawn
+extern int gpuParallelThreads;
+
+// registers of each line as it was passed
+extern gpu_lineregs gpuPassedLineRegs[144];
+
+// draws the given lines, each with the registers it was passed with
+void gpuRenderParallel(int first, int count);
+
+// points the calling thread's line buffer at its own storage, defined by the display driver
+void SetupDisplayThread();
+#endif
+
+#if CATCHUP_PPU
+// renders the pending lines, called before anything they are drawn from changes
+inline void gpuCatchUp() {
+#if LAZY_STAT
+	if (gpuFastLine()) {
+		gpuFastLineSync();
+	}
+#endif
+#if PPU_THREAD
+	gpuThreadWait();
+#else
+	if (gpuPendingLines.count) {
+		gpuRenderPendingLines();
+	}
+#endif
+}
+#else
+inline void gpuCatchUp() {}
+#endif
+
+// called before a scroll or window position register changes. The PPU thread and PARALLEL_LINES have them with each
+// line, so only the current line has to be passed if it is past mode 3 already
+inline void gpuCatchUpScroll() {
+#if PPU_THREAD || PARALLEL_LINES
+#if LAZY_STAT
+	if (gpuFastLine()) {
+		gpuFastLineSync();
+	}
+#endif
+#else
+	gpuCatchUp();
+#endif
+}
+
+// VRAM writes the renderers need to know about go through the slow path (pages with specialMap bit 2)
+#define VRAM_WRITE_TRACKING (TILE_CACHE || DIRTY_LINES || CATCHUP_PPU)
+
+#if VRAM_WRITE_TRACKING
+// write through the selected VRAM bank, keeps the tile cache, tile map surfaces and dirty lines up to date and renders
+// the pending lines first if the byte changes
+void gpuWriteVRAM(unsigned int address, unsigned char value);
+
+// the same for a range of VRAM offsets written directly (DMA, save state load)
+void gpuVRAMChanged(unsigned int offset, unsigned int length);
+#endif
+
+#if DIRTY_LINES
+// bumped when what the lines are drawn from changes
+struct gpu_generations {
+	unsigned int mapRows[64];					// 32 rows per tile map, includes the CGB attributes
+	unsigned int tiles;
+	unsigned int oam;
+	unsigned int palette;						// CGB palette memory and the display palette
+};
+
+extern gpu_generations gpuGenerations;
+
+struct gpu_linestats {
+	unsigned int linesRendered;
+	unsigned int linesSkipped;
+};
+
+extern PPU_LOCAL gpu_linestats gpuLineStats;
+
+// whether the current line (LY) has to be rendered, false if it would come out the same as last frame's. The scaled
+// display modes draw two lines together, with pairedLines set the first line of a pair is always rendered and the
+// second whenever either changed
+bool gpuLineNeedsRender(bool pairedLines);
+
+// whether the line changed this frame, the display drivers only send the changed lines to the LCD
+bool gpuLineDirty(int line);
+
+// the current line was drawn blank, it is rendered again next frame
+void gpuBlankLine();
+
+// all lines are rendered again next frame (display driver setup, display palette changes, save state load)
+void gpuInvalidateLines();
+#else
+inline bool gpuLineNeedsRender(bool pairedLines) { return true; }
+inline bool gpuLineDirty(int line) { return true; }
+inline void gpuBlankLine() {}
+inline void gpuInvalidateLines() {}
+#endif
+
+// called when CGB palette memory changes
+inline void paletteChanged() {
+#if DIRTY_LINES
+	gpuGenerations.palette++;
+#endif
+}
+
+// the sprites on each line are picked out of OAM once after it (or the sprite size) changes instead of on every line,
+// which also limits them to 10 per line like the hardware does. Can be overridden by defining SPRITE_LISTS as 0 or 1
+#ifndef SPRITE_LISTS
+#define SPRITE_LISTS 1
+#endif
+
+#if SPRITE_LISTS
+// OAM indices of the sprites on a line, lowest priority first so they are drawn in order
+struct gpu_spriteline {
+	unsigned char count;
+	unsigned char sprites[10];
+};
+
+extern gpu_spriteline spriteLines[144];
+extern bool spriteListsDirty;
+
+void buildSpriteLists();
+
+inline const gpu_spriteline& getSpriteLine(int line) {
+	if (spriteListsDirty) {
+		buildSpriteLists();
+	}
+	return spriteLines[line];
+}
+#endif
+
+// called when OAM or the sprite size changes
+inline void oamChanged() {
+#if SPRITE_LISTS
+	spriteListsDirty = true;
+#endif
+#if DIRTY_LINES
+	gpuGenerations.oam++;
+#endif
+}
 
 inline void resolveDMGBGPalette() {
 	ppuPalette[0] = ppuPalette[12 + ((cpu.memory.BGP_bgpalette & 0x03) >> 0)];
@@ -0,0 +1,290 @@
+#if TARGET_LINUX
+// for the PPU worker thread and render pool, ahead of the min/max macros in platform.h
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#endif
+
+#include "platform.h"
+#include "debug.h"
+
+#include "display.h"
+#include "memory.h"
+#include "cgb.h"
+#include "gpu.h"
+
+#if PPU_THREAD
+
+// more than a frame of lines, the cpu waits for the worker at the end of every frame so it never fills up
+#define PPU_RING_SIZE 256
+
+// times either side yields before it blocks, the worker is rarely more than a line or two behind
+#define PPU_SPINS 64
+
+gpu_threadstats gpuThreadStats = { 0 };
+
+// single producer / single consumer ring of lines to draw, the cpu thread adds them at head and the worker is done
+// with every line before tail
+static gpu_lineregs ring[PPU_RING_SIZE];
+static std::atomic<unsigned int> ringHead(0);
+static std::atomic<unsigned int> ringTail(0);
+
+// used to block either side once spinning doesn't pay off
+struct gpu_threadsync {
+	std::mutex mutex;
+	std::condition_variable workerWake;			// lines were added
+	std::condition_variable cpuWake;			// the worker caught up
+};
+
+// created with the worker and never destroyed, the worker still waits on it at exit
+static gpu_threadsync* threadSync = NULL;
+static std::atomic<bool> workerSleeping(false);
+static std::atomic<bool> cpuSleeping(false);
+
+static void ppuWorker() {
+	unsigned int tail = ringTail.load(std::memory_order_relaxed);
+
+	for (;;) {
+		int spins = 0;
+		while (ringHead.load() == tail) {
+			if (spins++ < PPU_SPINS) {
+				std::this_thread::yield();
+				continue;
+			}
+
+			std::unique_lock<std::mutex> lock(threadSync->mutex);
+			workerSleeping.store(true);
+			threadSync->workerWake.wait(lock, [tail] { return ringHead.load() != tail; });
+			workerSleeping.store(false);
+		}
+
+		// the worker has the display driver to itself while it has lines, they are drawn just like a catch-up batch
+		gpuLineRegs = ring[tail & (PPU_RING_SIZE - 1)];
+		renderScanline();
+
+		tail++;
+		ringTail.store(tail);
+
+		if (cpuSleeping.load()) {
+			std::lock_guard<std::mutex> lock(threadSync->mutex);
+			threadSync->cpuWake.notify_one();
+		}
+	}
+}
+
+void gpuThreadPush() {
+	if (!threadSync) {
+		threadSync = new gpu_threadsync;
+		std::thread(ppuWorker).detach();
+	}
+
+	const unsigned int head = ringHead.load(std::memory_order_relaxed);
+	if (head - ringTail.load() == PPU_RING_SIZE) {
+		gpuThreadWait();
+	}
+
+	gpuCaptureLineRegs(ring[head & (PPU_RING_SIZE - 1)]);
+	ringHead.store(head + 1);
+	gpuThreadStats.lines++;
+
+	if (workerSleeping.load()) {
+		std::lock_guard<std::mutex> lock(threadSync->mutex);
+		threadSync->workerWake.notify_one();
+	}
+}
+
+void gpuThreadWait() {
+	const unsigned int head = ringHead.load(std::memory_order_relaxed);
+	if (ringTail.load() == head)
+		return;
+
+	gpuThreadStats.waits++;
+
+	int spins = 0;
+	while (ringTail.load() != head) {
+		if (spins++ < PPU_SPINS) {
+			std::this_thread::yield();
+			continue;
+		}
+
+		gpuThreadStats.sleeps++;
+		std::unique_lock<std::mutex> lock(threadSync->mutex);
+		cpuSleeping.store(true);
+		threadSync->cpuWake.wait(lock, [head] { return ringTail.load() == head; });
+		cpuSleeping.store(false);
+	}
+}
+
+#endif
+
+#if PARALLEL_LINES
+
+// batches shorter than this are drawn on the cpu thread, waking the pool costs more than it saves
+#define PARALLEL_MIN_LINES 16
+
+// lines a thread takes at a time, even so the pairs the scaled display modes blend stay on one thread
+#define PARALLEL_CHUNK_LINES 4
+
+#define PARALLEL_MAX_THREADS 16
+
+gpu_parallelstats gpuParallelStats = { 0 };
+int gpuParallelThreads = 0;
+gpu_lineregs gpuPassedLineRegs[144];
+
+// the batch being drawn, guarded by the mutex except for the chunks which are taken off nextChunk
+struct gpu_renderpool {
+	std::mutex mutex;
+	std::condition_variable workerWake;			// a batch was handed out
+	std::condition_variable cpuWake;			// the last worker is done with it
+	unsigned int batch;
+	int first;
+	int count;
+	int busyWorkers;
+	std::atomic<int> nextChunk;
+
+	// line stats of the workers, added to the cpu thread's after each batch
+	unsigned int linesRendered;
+	unsigned int linesSkipped;
+};
+
+// created with the workers and never destroyed, they still wait on it at exit
+static gpu_renderpool* renderPool = NULL;
+static int renderThreads = 1;
+
+static void renderLines(int first, int count) {
+	for (int line = first; line < first + count; line++) {
+		gpuLineRegs = gpuPassedLineRegs[line];
+		renderScanline();
+	}
+}
+
+// draws chunks of the batch until they run out
+static void renderChunks(int first, int count) {
+	for (;;) {
+		const int start = renderPool->nextChunk.fetch_add(1) * PARALLEL_CHUNK_LINES;
+		if (start >= count)
+			return;
+
+		renderLines(first + start, min(PARALLEL_CHUNK_LINES, count - start));
+	}
+}
+
+static void renderWorker() {
+	SetupDisplayThread();
+
+	unsigned int batch = 0;
+	for (;;) {
+		int first, count;
+		{
+			std::unique_lock<std::mutex> lock(renderPool->mutex);
+			renderPool->workerWake.wait(lock, [batch] { return renderPool->batch != batch; });
+			batch = renderPool->batch;
+			first = renderPool->first;
+			count = renderPool->count;
+		}
+
+		renderChunks(first, count);
+
+		// every worker checks in for every batch, so none of them can still be on this one when the next starts
+		std::lock_guard<std::mutex> lock(renderPool->mutex);
+#if DIRTY_LINES
+		renderPool->linesRendered += gpuLineStats.linesRendered;
+		renderPool->linesSkipped += gpuLineStats.linesSkipped;
+		gpuLineStats.linesRendered = 0;
+		gpuLineStats.linesSkipped = 0;
+#endif
+		if (--renderPool->busyWorkers == 0) {
+			renderPool->cpuWake.notify_one();
+		}
+	}
+}
+
+static void startRenderPool() {
+	renderThreads = gpuParallelThreads > 0 ? gpuParallelThreads : (int) std::thread::hardware_concurrency();
+	renderThreads = max(1, min(renderThreads, PARALLEL_MAX_THREADS));
+
+	renderPool = new gpu_renderpool;
+	renderPool->batch = 0;
+	renderPool->busyWorkers = 0;
+	renderPool->nextChunk = 0;
+	renderPool->linesRendered = 0;
+	renderPool->linesSkipped = 0;
+
+	for (int i = 1; i < renderThreads; i++) {
+		std::thread(renderWorker).detach();
+	}
+}
+
+void gpuRenderParallel(int first, int count) {
+	if (!renderPool) {
+		startRenderPool();
+	}
+
+	if (renderThreads == 1 || count < PARALLEL_MIN_LINES) {
+		renderLines(first, count);
+		return;
+	}
+
+	// the pairs stay on one thread. An odd first line goes with the even line this thread drew at the end of the
+	// last batch, and an even last line with the odd line it draws at the start of the next
+	if (first & 1) {
+		renderLines(first, 1);
+		first++;
+		count--;
+	}
+	const bool evenLast = (count & 1) != 0;
+	if (evenLast) {
+		count--;
+	}
+
+	// what the renderers would set up when the first line needs it is set up here instead, before they share it
+	gpuLineRegs = gpuPassedLineRegs[first];
+#if SPRITE_LISTS
+	if (spriteListsDirty) {
+		buildSpriteLists();
+	}
+#endif
+#if BG_SURFACE
+	for (unsigned int row = 0; bgSurface && row < 64; row++) {
+		if (bgSurface->rowGeneration[row] != vramGeneration) {
+			bgSurfaceRefreshRow(row);
+		}
+	}
+#endif
+	if (cgb.isCGB && cgb.dirtyPalette) {
+		cgbResolvePalette();
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(renderPool->mutex);
+		renderPool->first = first;
+		renderPool->count = count;
+		renderPool->nextChunk = 0;
+		renderPool->busyWorkers = renderThreads - 1;
+		renderPool->batch++;
+	}
+	renderPool->workerWake.notify_all();
+
+	renderChunks(first, count);
+
+	{
+		std::unique_lock<std::mutex> lock(renderPool->mutex);
+		renderPool->cpuWake.wait(lock, [] { return renderPool->busyWorkers == 0; });
+#if DIRTY_LINES
+		gpuLineStats.linesRendered += renderPool->linesRendered;
+		gpuLineStats.linesSkipped += renderPool->linesSkipped;
+		renderPool->linesRendered = 0;
+		renderPool->linesSkipped = 0;
+#endif
+	}
+
+	if (evenLast) {
+		renderLines(first + count, 1);
+	}
+
+	gpuParallelStats.batches++;
+	gpuParallelStats.lines += count;
+}
+
+#endif
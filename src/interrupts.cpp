@@ -31,11 +31,6 @@ inline void issueInterrupt(unsigned char flagMask, unsigned short toPC) {
 }
 
 void interruptStep(void) {
-	// update timer in case it sends an interrupt
-	if (cpu.clocks >= cpu.timerInterrupt) {
-		updateTimer();
-	}
-
 	unsigned char fire = cpu.memory.IE_intenable & cpu.memory.IF_intflag;
 	if ((cpu.IME || cpu.halted) && fire) {
 
@@ -6,7 +6,7 @@
 
 struct keys_type keys;
 
-#if !TARGET_WINSIM
+#if !TARGET_WINSIM && !TARGET_LINUX
 // returns true if the key is down, false if up
 bool keyDown_fast(unsigned char keyCode) {
 	static const unsigned short* keyboard_register = (unsigned short*)0xA44B0000;
@@ -0,0 +1,248 @@
+// Linux host implementation of the fxcg API subset declared in fxcg_linux.h
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "platform.h"
+#include "keys.h"
+#include "gpu.h"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Display
+
+static unsigned short hostVRAM[LCD_WIDTH_PX * LCD_HEIGHT_PX];
+
+void* GetVRAMAddress(void) {
+	return hostVRAM;
+}
+
+void Bdisp_PutDisp_DD(void) {
+	// nothing to present to, the VRAM contents are inspected directly by the harness
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Timing
+
+unsigned long long HostMicroseconds(void) {
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+int RTC_GetTicks(void) {
+	return (int) (HostMicroseconds() * 128 / 1000000);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Text output (printf is routed here by platform.h)
+
+void reset_printf() {
+}
+
+void ScreenPrint(char* buffer) {
+	size_t len = strlen(buffer);
+	fputs(buffer, stdout);
+	if (len == 0 || buffer[len - 1] != '\n') {
+		fputc('\n', stdout);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// File system
+
+#define MAX_HOST_HANDLES 256
+
+static char flashRoot[256] = ".";
+
+// mmap'd views for Bfile_GetBlockAddress, indexed by handle (which is the file descriptor)
+static unsigned char* mappedView[MAX_HOST_HANDLES] = { 0 };
+static size_t mappedSize[MAX_HOST_HANDLES] = { 0 };
+
+void HostSetFlashRoot(const char* path) {
+	strncpy(flashRoot, path, sizeof(flashRoot) - 1);
+	flashRoot[sizeof(flashRoot) - 1] = 0;
+}
+
+// converts a "\\fls0\dir\file" OS name to a host path below the flash root
+static void hostPath(const unsigned short* filename, char* path, int pathSize) {
+	char name[256];
+	int len = 0;
+	while (filename[len] && len < 255) {
+		name[len] = filename[len] == '\\' ? '/' : (char) filename[len];
+		len++;
+	}
+	name[len] = 0;
+
+	const char* relative = name;
+	if (!strncmp(relative, "//fls0/", 7)) {
+		relative += 7;
+	}
+
+	snprintf(path, pathSize, "%s/%s", flashRoot, relative);
+}
+
+void Bfile_StrToName_ncpy(unsigned short* dest, const char* source, size_t n) {
+	size_t i = 0;
+	for (; i < n && source[i]; i++) {
+		dest[i] = (unsigned char) source[i];
+	}
+	for (; i < n; i++) {
+		dest[i] = 0;
+	}
+}
+
+int Bfile_OpenFile_OS(const unsigned short* filename, int mode, int zero) {
+	char path[512];
+	hostPath(filename, path, sizeof(path));
+
+	int flags = O_RDONLY;
+	if (mode == WRITE) {
+		flags = O_WRONLY;
+	} else if (mode == READWRITE || mode == READWRITE_SHARE) {
+		flags = O_RDWR;
+	}
+
+	int fd = open(path, flags);
+	if (fd < 0) {
+		return -1;
+	}
+	if (fd >= MAX_HOST_HANDLES) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+int Bfile_CreateEntry_OS(const unsigned short* filename, int mode, size_t* size) {
+	char path[512];
+	hostPath(filename, path, sizeof(path));
+
+	if (mode == CREATEMODE_FOLDER) {
+		return mkdir(path, 0755) ? -1 : 0;
+	}
+
+	int fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0644);
+	if (fd < 0) {
+		return -1;
+	}
+
+	int ret = 0;
+	if (size && ftruncate(fd, *size)) {
+		ret = -1;
+	}
+	close(fd);
+
+	return ret;
+}
+
+int Bfile_DeleteEntry(const unsigned short* filename) {
+	char path[512];
+	hostPath(filename, path, sizeof(path));
+
+	return unlink(path) ? -1 : 0;
+}
+
+int Bfile_ReadFile_OS(int handle, void* buf, int size, int readpos) {
+	// like the OS, reading at a position moves the file position there so following reads at -1 continue after it
+	if (readpos >= 0 && lseek(handle, readpos, SEEK_SET) < 0) {
+		return -1;
+	}
+	return (int) read(handle, buf, size);
+}
+
+int Bfile_WriteFile_OS(int handle, const void* buf, int size) {
+	return (int) write(handle, buf, size);
+}
+
+int Bfile_SeekFile_OS(int handle, int pos) {
+	return (int) lseek(handle, pos, SEEK_SET);
+}
+
+int Bfile_TellFile_OS(int handle) {
+	return (int) lseek(handle, 0, SEEK_CUR);
+}
+
+int Bfile_GetFileSize_OS(int handle) {
+	struct stat st;
+	if (fstat(handle, &st)) {
+		return -1;
+	}
+	return (int) st.st_size;
+}
+
+int Bfile_CloseFile_OS(int handle) {
+	if (handle >= 0 && handle < MAX_HOST_HANDLES && mappedView[handle]) {
+		munmap(mappedView[handle], mappedSize[handle]);
+		mappedView[handle] = NULL;
+		mappedSize[handle] = 0;
+	}
+
+	return close(handle) ? -1 : 0;
+}
+
+int Bfile_GetBlockAddress(int handle, int pos, unsigned char** blockAddress) {
+	if (handle < 0 || handle >= MAX_HOST_HANDLES) {
+		return -1;
+	}
+
+	if (!mappedView[handle]) {
+		int size = Bfile_GetFileSize_OS(handle);
+		if (size <= 0) {
+			return -1;
+		}
+
+		void* view = mmap(NULL, size, PROT_READ, MAP_PRIVATE, handle, 0);
+		if (view == MAP_FAILED) {
+			return -1;
+		}
+
+		mappedView[handle] = (unsigned char*) view;
+		mappedSize[handle] = size;
+	}
+
+	if (pos < 0 || (size_t) pos >= mappedSize[handle]) {
+		return -1;
+	}
+
+	*blockAddress = mappedView[handle] + pos;
+	return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Scripted keys
+
+struct host_keypress {
+	unsigned int startFrame;
+	unsigned int endFrame;
+	unsigned char keyCode;
+};
+
+#define MAX_HOST_KEYPRESSES 1024
+
+static host_keypress keyPresses[MAX_HOST_KEYPRESSES];
+static int numKeyPresses = 0;
+
+bool HostAddKeyPress(unsigned int startFrame, unsigned int endFrame, unsigned char keyCode) {
+	if (numKeyPresses == MAX_HOST_KEYPRESSES) {
+		return false;
+	}
+
+	keyPresses[numKeyPresses].startFrame = startFrame;
+	keyPresses[numKeyPresses].endFrame = endFrame;
+	keyPresses[numKeyPresses].keyCode = keyCode;
+	numKeyPresses++;
+	return true;
+}
+
+// keys are a pure function of the emulated frame so runs are reproducible
+bool keyDown_fast(unsigned char keyCode) {
+	for (int i = 0; i < numKeyPresses; i++) {
+		if (keyPresses[i].keyCode == keyCode && framecounter >= keyPresses[i].startFrame && framecounter < keyPresses[i].endFrame) {
+			return true;
+		}
+	}
+	return false;
+}
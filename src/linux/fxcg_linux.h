@@ -0,0 +1,57 @@
+#pragma once
+
+// Stand-in for the subset of the fxcg (Prizm OS) API used by the emulation core, so that it can
+// be built and run headless on a Linux host. File I/O is POSIX backed, VRAM lives in memory, and
+// keys are scripted by frame number.
+
+#include <stddef.h>
+
+// display
+#define LCD_WIDTH_PX 384
+#define LCD_HEIGHT_PX 216
+
+#define COLOR_BLACK 0x0000
+#define COLOR_WHITE 0xFFFF
+#define COLOR_SILVER 0xC618
+
+void* GetVRAMAddress(void);
+void Bdisp_PutDisp_DD(void);
+
+// rtc (1/128 second ticks)
+int RTC_GetTicks(void);
+
+// file system, paths are "\\fls0\..." style and are mapped below the host flash root
+#define READ 0
+#define READ_SHARE 1
+#define WRITE 2
+#define READWRITE 3
+#define READWRITE_SHARE 4
+
+#define CREATEMODE_FILE 1
+#define CREATEMODE_FOLDER 5
+
+void Bfile_StrToName_ncpy(unsigned short* dest, const char* source, size_t n);
+int Bfile_OpenFile_OS(const unsigned short* filename, int mode, int zero);
+int Bfile_CreateEntry_OS(const unsigned short* filename, int mode, size_t* size);
+int Bfile_DeleteEntry(const unsigned short* filename);
+int Bfile_ReadFile_OS(int handle, void* buf, int size, int readpos);
+int Bfile_WriteFile_OS(int handle, const void* buf, int size);
+int Bfile_SeekFile_OS(int handle, int pos);
+int Bfile_TellFile_OS(int handle);
+int Bfile_GetFileSize_OS(int handle);
+int Bfile_CloseFile_OS(int handle);
+
+// direct pointer to the file contents at pos (an mmap'd view on the host)
+int Bfile_GetBlockAddress(int handle, int pos, unsigned char** blockAddress);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Host only functionality
+
+// directory that "\\fls0\" maps to
+void HostSetFlashRoot(const char* path);
+
+// holds the given key code down from startFrame up to (not including) endFrame
+bool HostAddKeyPress(unsigned int startFrame, unsigned int endFrame, unsigned char keyCode);
+
+// monotonic host time in microseconds
+unsigned long long HostMicroseconds(void);
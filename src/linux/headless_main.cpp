@@ -0,0 +1,325 @@
+// Headless host runner, boots a ROM and runs it for a fixed number of frames as fast as possible
+// and reports emulation speed. Usage:
+//
+//   prizoop-headless <rom> [-frames N] [-keys script] [-scale none|lo150|hi150|lo200|hi200] [-hash] [-save] [-profile] [-cache N] [-threads N]
+//
+// The key script is a text file of "startFrame endFrame BUTTON" lines, where BUTTON is one of
+// A, B, SELECT, START, RIGHT, LEFT, UP, DOWN. Presses are keyed on the emulated frame number so
+// runs are reproducible.
+//
+// -profile writes the ROM's .prf bank cache profile at the end, so a key script can record one ahead of time.
+// -cache uses N 4k bank cache slots instead of sizing the cache for the ROM.
+// -threads draws the catch-up batches with N render threads when built with PARALLEL_LINES (one per core by default).
+
+#include "platform.h"
+#include "emulator.h"
+#include "memory.h"
+#include "cgb.h"
+#include "gpu.h"
+#include "display.h"
+#include "keys.h"
+#include "rom.h"
+#include "cgb_bootstrap.h"
+#include "mbc.h"
+
+emulator_type emulator;
+
+static const char* buttonNames[emu_button::MAX] = {
+	"A", "B", "SELECT", "START", "RIGHT", "LEFT", "UP", "DOWN", "STATE_SAVE", "STATE_LOAD"
+};
+
+// each button gets a unique fake key code that the scripted keyDown_fast understands (48 is MENU)
+static unsigned char buttonKeyCode(int button) {
+	return (unsigned char) (button + 1);
+}
+
+static bool loadKeyScript(const char* filename) {
+	FILE* file = fopen(filename, "r");
+	if (!file) {
+		printf("Could not open key script %s", filename);
+		return false;
+	}
+
+	char line[128];
+	int lineNum = 0;
+	while (fgets(line, sizeof(line), file)) {
+		lineNum++;
+		if (line[0] == '#' || line[0] == '\n') {
+			continue;
+		}
+
+		unsigned int start, end;
+		char name[32];
+		if (sscanf(line, "%u %u %31s", &start, &end, name) != 3) {
+			printf("Bad key script line %d", lineNum);
+			fclose(file);
+			return false;
+		}
+
+		int button = 0;
+		while (button < emu_button::MAX && strcmp(buttonNames[button], name)) {
+			button++;
+		}
+		if (button == emu_button::MAX || !HostAddKeyPress(start, end, buttonKeyCode(button))) {
+			printf("Bad key script line %d", lineNum);
+			fclose(file);
+			return false;
+		}
+	}
+
+	fclose(file);
+	return true;
+}
+
+static void setupSettings(unsigned char scaleMode) {
+	memset(&emulator, 0, sizeof(emulator));
+
+	emulator.settings.version = SETTINGS_VERSION;
+	emulator.settings.scaleMode = scaleMode;
+	emulator.settings.frameSkip = 0;
+	emulator.settings.clampSpeed = false;
+	emulator.settings.useCGBColors = true;
+	emulator.settings.sound = false;
+
+	for (int i = 0; i < emu_button::MAX; i++) {
+		emulator.settings.keyMap[i] = buttonKeyCode(i);
+	}
+}
+
+static void setupDMGPalette() {
+	static const unsigned short grays[4] = { 0xFFFF, 0xAD55, 0x52AA, 0x0000 };
+
+	if (!getCGBTableEntry(&readMap[0][ROM_OFFSET_NAME], &ppuPalette[12])) {
+		for (int i = 0; i < 12; i++) {
+			ppuPalette[i + 12] = grays[i & 3] | (grays[i & 3] << 16);
+		}
+	}
+
+	SetupDisplayPalette();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Frame tracking
+
+static unsigned int maxFrames = 600;
+static unsigned int frames = 0;
+static bool hashFrames = false;
+static unsigned int frameHash = 2166136261u;
+static void(*baseDrawFramebuffer)(void) = NULL;
+
+static unsigned int fnvHash(unsigned int hash, const void* data, int size) {
+	for (int i = 0; i < size; i++) {
+		hash = (hash ^ ((const unsigned char*) data)[i]) * 16777619u;
+	}
+	return hash;
+}
+
+static void headlessDraw() {
+	baseDrawFramebuffer();
+
+	// cpuStep may run past the requested frame count before it returns, ignore those frames
+	frames++;
+	if (hashFrames && frames <= maxFrames) {
+		// hash the whole VRAM so rendering differences anywhere show up
+		frameHash = fnvHash(frameHash, GetVRAMAddress(), LCD_WIDTH_PX * LCD_HEIGHT_PX * 2);
+	}
+
+	if (frames >= maxFrames) {
+		keys.exit = true;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char** argv) {
+	const char* romPath = NULL;
+	unsigned char scaleMode = emu_scale::NONE;
+	bool writeSave = false;
+	bool writeProfile = false;
+
+	// allocate cached mbc banks on the stack
+	ALLOCATE_CACHED_BANKS();
+
+	setupSettings(scaleMode);
+
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-frames") && i + 1 < argc) {
+			maxFrames = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "-keys") && i + 1 < argc) {
+			if (!loadKeyScript(argv[++i]))
+				return 1;
+		} else if (!strcmp(argv[i], "-scale") && i + 1 < argc) {
+			static const char* scaleNames[emu_scale::MAX] = { "none", "lo150", "hi150", "lo200", "hi200" };
+			const char* name = argv[++i];
+			scaleMode = 0;
+			while (scaleMode < emu_scale::MAX && strcmp(scaleNames[scaleMode], name)) {
+				scaleMode++;
+			}
+			if (scaleMode == emu_scale::MAX) {
+				printf("Unknown scale mode %s", name);
+				return 1;
+			}
+			emulator.settings.scaleMode = scaleMode;
+		} else if (!strcmp(argv[i], "-hash")) {
+			hashFrames = true;
+		} else if (!strcmp(argv[i], "-save")) {
+			writeSave = true;
+		} else if (!strcmp(argv[i], "-profile")) {
+			writeProfile = true;
+		} else if (!strcmp(argv[i], "-cache") && i + 1 < argc) {
+			mbcCacheSlots = atoi(argv[++i]);
+#if PARALLEL_LINES
+		} else if (!strcmp(argv[i], "-threads") && i + 1 < argc) {
+			gpuParallelThreads = atoi(argv[++i]);
+#endif
+		} else if (argv[i][0] != '-' && !romPath) {
+			romPath = argv[i];
+		} else {
+			printf("Unknown argument %s", argv[i]);
+			return 1;
+		}
+	}
+
+	// battery RAM is only written with -save
+	if (!writeSave) {
+		sramAutoSaveFrames = 0;
+	}
+
+	if (!romPath) {
+		printf("Usage: %s <rom> [-frames N] [-keys script] [-scale none|lo150|hi150|lo200|hi200] [-hash] [-save] [-profile] [-cache N] [-threads N]", argv[0]);
+		return 1;
+	}
+
+	// the rom directory acts as the root of the flash file system
+	char romDir[256];
+	strncpy(romDir, romPath, sizeof(romDir) - 1);
+	romDir[sizeof(romDir) - 1] = 0;
+	char* romName = strrchr(romDir, '/');
+	if (romName) {
+		*romName++ = 0;
+		HostSetFlashRoot(romDir[0] ? romDir : "/");
+	} else {
+		romName = romDir;
+		HostSetFlashRoot(".");
+	}
+
+	if (strlen(romName) >= sizeof(emulator.settings.selectedRom)) {
+		printf("ROM filename too long: %s", romName);
+		return 1;
+	}
+	strcpy(emulator.settings.selectedRom, romName);
+
+	if (!loadROM(romName)) {
+		printf("Failed to load %s", romPath);
+		return 1;
+	}
+
+	sndStartup();
+
+	if (!cgb.isCGB) {
+		setupDMGPalette();
+	}
+
+	SetupDisplayDriver(emulator.settings.frameSkip);
+	baseDrawFramebuffer = drawFramebuffer;
+	drawFramebuffer = headlessDraw;
+
+	// count cycles across cpuStep calls, each call may normalize cpu.clocks back by 1M
+	unsigned long long cycles = 0;
+	unsigned long long startTime = HostMicroseconds();
+
+	keys.exit = false;
+	while (keys.exit == false) {
+		unsigned int startClocks = cpu.clocks;
+		cpuStep();
+		unsigned int endClocks = cpu.clocks;
+		if (endClocks < startClocks) {
+			endClocks += 1024 * 1024;
+		}
+		cycles += endClocks - startClocks;
+	}
+
+#if PPU_THREAD
+	// the lines of the frame cpuStep ran into may still be on the worker
+	gpuThreadWait();
+#endif
+
+	unsigned long long elapsed = HostMicroseconds() - startTime;
+	if (elapsed == 0) {
+		elapsed = 1;
+	}
+
+	if (writeSave) {
+		saveRAM();
+	}
+	if (writeProfile) {
+		saveProfile();
+	}
+
+	frames = min(frames, maxFrames);
+	printf("Frames: %u in %llu.%03llu s", frames, elapsed / 1000000, (elapsed / 1000) % 1000);
+	printf("Emulated FPS: %.1f", frames * 1000000.0 / elapsed);
+	printf("Cycles/sec: %.0f (%.2fx realtime)", cycles * 1000000.0 / elapsed, cycles * 1000000.0 / elapsed / (4194304 << cgb.isDouble));
+
+#if IDLE_LOOP_SKIP
+	printf("Idle loops: %u found, %u skips, %llu cycles skipped (%.1f%%)", cpuIdleStats.loopsFound, cpuIdleStats.fastForwards,
+		cpuIdleStats.cyclesSkipped, cycles ? cpuIdleStats.cyclesSkipped * 100.0 / cycles : 0.0);
+#endif
+
+#if CATCHUP_PPU
+	printf("Catch-up batches: %u (%.1f lines each)", gpuCatchUpStats.batches,
+		gpuCatchUpStats.batches ? gpuCatchUpStats.lines / (double) gpuCatchUpStats.batches : 0.0);
+#endif
+
+#if PPU_THREAD
+	printf("PPU thread: %u lines, %u waits (%u blocked)", gpuThreadStats.lines, gpuThreadStats.waits, gpuThreadStats.sleeps);
+#endif
+
+#if PARALLEL_LINES
+	printf("Parallel lines: %u batches, %u lines (%.1f per frame)", gpuParallelStats.batches, gpuParallelStats.lines,
+		frames ? gpuParallelStats.lines / (double) frames : 0.0);
+#endif
+
+#if LAZY_STAT
+	printf("Fast lines: %u, %u with mode transitions", gpuLineModeStats.fastLines, gpuLineModeStats.fullLines);
+#endif
+
+#if DIRTY_LINES
+	printf("Dirty lines: %u rendered, %u skipped (%.1f rendered per frame)", gpuLineStats.linesRendered, gpuLineStats.linesSkipped,
+		frames ? gpuLineStats.linesRendered / (double) frames : 0.0);
+#endif
+
+	printf("ROM bank switches: %u (%.1f per frame)", mbcStats.romBankSwitches, frames ? mbcStats.romBankSwitches / (double) frames : 0.0);
+	printf("ROM bank cache: %u hits, %u misses, %u evictions", mbcStats.cacheHits, mbcStats.cacheMisses, mbcStats.cacheEvictions);
+#if MBC_PROFILE
+	if (mbcStats.pinnedPages) {
+		printf("ROM profile: %u pages pinned", mbcStats.pinnedPages);
+	}
+#endif
+	if (mbcStats.sramSaves) {
+		printf("Battery RAM saves: %u, %.1f dirty pages each, %.2f ms avg, %.2f ms max", mbcStats.sramSaves, mbcStats.sramPagesSaved / (double) mbcStats.sramSaves,
+			mbcStats.sramSaveMicroseconds / 1000.0 / mbcStats.sramSaves, mbcStats.sramSaveMaxMicroseconds / 1000.0);
+	}
+#if MBC_PREFETCH
+	if (mbcStats.prefetches) {
+		// each used prefetched page is a miss that didn't happen, at the average miss cost
+		double missCost = mbcStats.cacheMisses ? mbcStats.missMicroseconds / (double) mbcStats.cacheMisses : 0.0;
+		printf("ROM prefetch: %u pages, %u used (%.1f%%), ~%.1f ms stall saved, %.1f ms waited", mbcStats.prefetches, mbcStats.prefetchHits,
+			mbcStats.prefetchHits * 100.0 / mbcStats.prefetches, mbcStats.prefetchHits * missCost / 1000.0, mbcStats.prefetchWaitMicroseconds / 1000.0);
+	}
+#endif
+
+	if (hashFrames) {
+		printf("Frame hash: %08x", frameHash);
+
+		// cpu registers and work/high ram, stable for test ROMs that finish by halting with interrupts off
+		cpuSyncFlags();
+		unsigned int stateHash = fnvHash(2166136261u, &cpu.registers, sizeof(cpu.registers));
+		stateHash = fnvHash(stateHash, wram_perm, sizeof(wram_perm));
+		stateHash = fnvHash(stateHash, wram_gb, sizeof(wram_gb));
+		stateHash = fnvHash(stateHash, cpu.memory.hram, sizeof(cpu.memory.hram));
+		printf("State hash: %08x", stateHash);
+	}
+
+	return 0;
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+// Headless stand-in for the scope_timer library, timing on the host is done by the caller.
+
+#define TIME_SCOPE()
+
+struct ScopeTimer {
+	static char debugString[128];
+
+	static void InitSystem() {}
+	static void ReportFrame() {}
+	static void DisplayTimes() {}
+	static void Shutdown() {}
+};
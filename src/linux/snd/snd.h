@@ -0,0 +1,13 @@
+#pragma once
+
+// Headless stand-in for the snd library, the host build produces no audio so these are all no-ops.
+// The channel state in snd_main.cpp is still emulated so save states stay compatible.
+
+#define SOUND_RATE 16384
+
+inline bool sndInit() { return false; }
+inline void sndCleanup() {}
+inline void sndUpdate() {}
+inline void sndVolumeUp() {}
+inline void sndVolumeDown() {}
+inline void condSoundUpdate() {}
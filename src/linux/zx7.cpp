@@ -0,0 +1,80 @@
+// Host build ZX7 decompressor, matches the reference dzx7 decoder
+
+#include "zx7/zx7.h"
+
+struct zx7_reader {
+	const unsigned char* src;
+	unsigned char bitMask;
+	unsigned char bitValue;
+
+	unsigned char readByte() {
+		return *src++;
+	}
+
+	int readBit() {
+		bitMask >>= 1;
+		if (bitMask == 0) {
+			bitMask = 128;
+			bitValue = readByte();
+		}
+		return (bitValue & bitMask) ? 1 : 0;
+	}
+
+	// returns -1 on the end marker
+	int readEliasGamma() {
+		int i = 0;
+		while (!readBit()) {
+			i++;
+		}
+		if (i > 15) {
+			return -1;
+		}
+
+		int value = 1;
+		while (i--) {
+			value = (value << 1) | readBit();
+		}
+		return value;
+	}
+
+	int readOffset() {
+		int value = readByte();
+		if (value < 128) {
+			return value;
+		}
+
+		int i = readBit();
+		i = (i << 1) | readBit();
+		i = (i << 1) | readBit();
+		i = (i << 1) | readBit();
+		return ((value & 127) | (i << 7)) + 128;
+	}
+};
+
+void ZX7Decompress(const unsigned char* src, unsigned char* dst, int dstSize) {
+	if (dstSize <= 0)
+		return;
+
+	zx7_reader reader = { src, 0, 0 };
+	int pos = 0;
+
+	dst[pos++] = reader.readByte();
+	while (pos < dstSize) {
+		if (!reader.readBit()) {
+			dst[pos++] = reader.readByte();
+		} else {
+			int length = reader.readEliasGamma() + 1;
+			if (length == 0)
+				break;
+
+			int offset = reader.readOffset() + 1;
+			if (offset > pos)
+				break;
+
+			while (length-- && pos < dstSize) {
+				dst[pos] = dst[pos - offset];
+				pos++;
+			}
+		}
+	}
+}
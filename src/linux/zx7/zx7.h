@@ -0,0 +1,5 @@
+#pragma once
+
+// Standard ZX7 decompressor (Einar Saukas' format), used for .gbz ROM pages. Never writes more
+// than dstSize bytes to dst.
+void ZX7Decompress(const unsigned char* src, unsigned char* dst, int dstSize);
@@ -1,28 +1,67 @@
 
+#if TARGET_LINUX
+// for the prefetch worker thread, ahead of the min/max macros in platform.h
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#endif
+
 #include "platform.h"
 
 #include "mbc.h"
 #include "keys.h"
 #include "memory.h"
 #include "emulator.h"
+#include "display.h"
 #include "snd/snd.h"
 
 #include "zx7/zx7.h"
 
 // cached banks
-mbc_bankcache* cachedBanks[NUM_CACHED_BANKS];
-unsigned int cachedBankIndex[NUM_CACHED_BANKS];
-unsigned int lastCacheRequestIndex[NUM_CACHED_BANKS];
-int cacheIndex = 0;
+mbc_bankcache* cachedBanks[MAX_CACHED_BANKS];
+unsigned int cachedBankIndex[MAX_CACHED_BANKS];
+unsigned int cachedBankGeneration[MAX_CACHED_BANKS];
+unsigned int numCachedBanks = NUM_CACHED_BANKS;
+unsigned int numHeapCachedBanks = 0;
+
+// stack slots the rom cache uses, the rest hold the RAM banks when there was no heap for them. The heap banks follow
+static unsigned int numStackCachedBanks = NUM_CACHED_BANKS;
+unsigned int mbcCacheSlots = MBC_CACHE_SLOTS;
+
+// the whole ROM is in the cache, page i in slot i
+static bool romResident = false;
+static bool romResidentLoaded = false;
+
+// slot each rom page is cached in (or -1), direct lookup for every 4k page of a 4 MB ROM
+static short cachedPageSlot[MAX_ROM_PAGES];
+
+// CLOCK replacement, a slot that was used since the hand last passed it gets a second chance
+static unsigned char cachedBankReferenced[MAX_CACHED_BANKS];
+static unsigned int cacheHand = 0;
+
+// cartridge RAM, sram for up to 8 KB or one allocation of getRAMSize() for RAM banks
+unsigned char* sramArena = sram;
+
+// pages pinned from the rom's profile sit in the first slots and are never replaced
+static unsigned int numPinnedPages = 0;
+
+// battery RAM pages (256 bytes each, by offset in sramArena) written since the last save. Clean pages aren't mapped for
+// writing so the first write to each one goes through mbcSRAMWrite
+#define MAX_SRAM_PAGES (128 * 1024 / 256)
+static unsigned int sramDirty[MAX_SRAM_PAGES / 32];
+static unsigned int sramDirtyPages = 0;
 
-// for higher RAM requirements, we use cached banks to store our ram, the rest our stored starting with firstRomCache, as indicated by this var
-unsigned int firstRomCache = 0;
+// frames the battery RAM has gone without a write, and where to save it
+static unsigned int sramQuietFrames = 0;
+static const char* sramFile = NULL;
 
-// sram hash (for checking dirty state, need to save)
-unsigned int sramHash = 0;
+// auto save couldn't open the file, wait for another write before trying again
+static bool sramSaveFailed = false;
+unsigned int sramAutoSaveFrames = SRAM_AUTOSAVE_FRAMES;
 
 // the memory bus controller object
 mbc_state mbc;
+mbc_stats mbcStats;
 
 // the real time clock object
 rtc_state rtc;
@@ -90,7 +129,45 @@ unsigned int getRAMSize() {
 	}
 }
 
-// we don't support large RAM sizes yet..
+// frees the RAM bank arena of the last ROM, if it had one
+static void freeRAMBanks() {
+	if (numStackCachedBanks != NUM_CACHED_BANKS) {
+		// the arena is the first stack slots, give them back to the rom cache
+		mbcFreeCache();
+		mbc_bankcache* stackBanks = (mbc_bankcache*) sramArena;
+		for (int i = 0; i < NUM_CACHED_BANKS; i++) {
+			cachedBanks[i] = &stackBanks[i];
+		}
+		numStackCachedBanks = NUM_CACHED_BANKS;
+	} else if (sramArena != sram) {
+		free((void*) sramArena);
+	}
+	sramArena = sram;
+}
+
+// allocates the RAM banks as one block, so they save and load in one go. Without the heap for it, the banks go in the
+// first stack slots of the rom cache instead, one for each 4k like the RAM banks always used to
+static bool allocateRAMBanks() {
+	sramArena = (unsigned char*) malloc(getRAMSize());
+	if (!sramArena) {
+		const unsigned int slots = getRAMSize() / 0x1000;
+		DebugAssert(cachedBanks[slots - 1] == cachedBanks[0] + slots - 1);
+
+		mbcFreeCache();
+		sramArena = cachedBanks[0]->bank;
+		numStackCachedBanks = NUM_CACHED_BANKS - slots;
+		for (unsigned int i = 0; i < numStackCachedBanks; i++) {
+			cachedBanks[i] = cachedBanks[i + slots];
+		}
+		for (unsigned int i = numStackCachedBanks; i < NUM_CACHED_BANKS; i++) {
+			cachedBanks[i] = NULL;
+		}
+	}
+
+	memset(sramArena, 0, getRAMSize());
+	return true;
+}
+
 bool supportedRAM(ramSizeType type) {
 	// not yet supporting RAM bank switching:
 	switch (type) {
@@ -101,26 +178,19 @@ bool supportedRAM(ramSizeType type) {
 			// sram will do
 			mbc.ramBank = 0;
 			mbc.numRamBanks = 1;
-			firstRomCache = 0;
 			return true;
 		case RAM_32KB:
-			// need 2 pages:
 			mbc.ramBank = 0;
 			mbc.numRamBanks = 4;
-			firstRomCache = 8;
-			return true;
+			return allocateRAMBanks();
 		case RAM_64KB:
-			// need 4 pages:
 			mbc.ramBank = 0;
 			mbc.numRamBanks = 8;
-			firstRomCache = 16;
-			return true;
+			return allocateRAMBanks();
 		case RAM_128KB:
-			// need 8 pages:
 			mbc.ramBank = 0;
 			mbc.numRamBanks = 16;
-			firstRomCache = 32;
-			return true;
+			return allocateRAMBanks();
 	}
 
 	return false;
@@ -142,16 +212,60 @@ unsigned char ramNibbleCount(ramSizeType type) {
 	return 0;
 }
 
+static void mapRomBank();
+static void prefetchDrain();
+static void loadResidentRom();
+static void rtcWrite(unsigned char value);
+
+// time source for the stall and save stats
+static unsigned int mbcMicroseconds() {
+#if TARGET_LINUX
+	return (unsigned int) HostMicroseconds();
+#else
+	return (unsigned long long) RTC_GetTicks() * 15625 / 2;		// 1/128 s ticks, in 64 bits as the product passes 2^31 about 18 minutes after midnight
+#endif
+}
+
 // support up to a 4 MB ROM 
-static unsigned char* BlockAddresses[1024] = { 0 };
+static unsigned char* BlockAddresses[MAX_ROM_PAGES] = { 0 };
+static int numBlockAddresses = 0;
+
+#if ROM_ZERO_COPY
+unsigned int romMapGeneration = 0;
+
+// last 256 bytes of each mapped 4k block plus the 2 bytes that follow it in the ROM, for when the next block isn't
+// right after it in memory and an instruction straddles the end
+static unsigned char romShadow[4][0x102];
+#endif
+
 void mbcFileUpdate() {
+	// the prefetch worker may be reading from the old block addresses
+	prefetchDrain();
+	numBlockAddresses = 0;
+
 	int numBlocks = (Bfile_GetFileSize_OS(mbc.romFile) + 4095) / 4096; // 16k ROM banks means 4 4k blocks a piece
+	numBlocks = min(numBlocks, MAX_ROM_PAGES);
 	for (int i = 0; i < numBlocks; i++) {
 		int ret = Bfile_GetBlockAddress(mbc.romFile, i * 0x1000, &BlockAddresses[i]);
 		if (ret < 0)
 			// error!
 			return;
 	}
+	numBlockAddresses = numBlocks;
+
+#if ROM_ZERO_COPY
+	// blocks may have moved, anything decoded from the old addresses is stale
+	romMapGeneration++;
+#endif
+
+	if (romResident && !romResidentLoaded) {
+		loadResidentRom();
+	}
+
+	// the selected bank can be read from the file now
+	if (mbc.numRomBanks) {
+		mapRomBank();
+	}
 }
 
 static int mbcReadFile(unsigned char* into, unsigned int size, unsigned int offset) {
@@ -208,84 +322,635 @@ bool mbcReadPage(unsigned int bankIndex, unsigned char* target, bool instrOverla
 	return false;
 }
 
-// returns the cached rom bank (or caches it) with the given index (which is a a factor of the number of caches per rom bank)
-mbc_bankcache* cacheBank(unsigned int index) {
-	cacheIndex++;
+#if MBC_PREFETCH
+// first order markov table of rom bank switches, the bank most likely selected after each one
+static unsigned char bankSuccessor[256];
+static unsigned char bankConfidence[256];
+
+// slot holds a page that was prefetched and hasn't been used yet
+static unsigned char cachedBankPrefetched[MAX_CACHED_BANKS];
 
-	// rare case: on overflow, the cache system needs a reset
-	if (cacheIndex == 0) {
-		for (int i = firstRomCache; i < NUM_CACHED_BANKS; i++) {
-			lastCacheRequestIndex[i] = 0;
+// pages of the predicted bank still to be prefetched
+static unsigned int prefetchIndex = 0;
+static unsigned int prefetchLeft = 0;
+#endif
+
+#if MBC_PREFETCH_THREAD
+// prefetched pages are read on a worker thread, a slot is marked loading until the worker is done with it
+struct mbc_prefetchsync {
+	std::mutex mutex;
+	std::condition_variable wake;			// jobs were queued
+	std::condition_variable done;			// a job finished
+};
+
+// created with the worker and never destroyed, the worker still waits on it at exit
+static mbc_prefetchsync* prefetchSync = NULL;
+static unsigned char cachedBankLoading[MAX_CACHED_BANKS];
+static unsigned char cachedBankFailed[MAX_CACHED_BANKS];
+static int prefetchJobSlot[4];
+static unsigned int prefetchJobIndex[4];
+static int numPrefetchJobs = 0;
+static int numPrefetchInFlight = 0;
+
+static void prefetchWorker() {
+	std::unique_lock<std::mutex> lock(prefetchSync->mutex);
+	for (;;) {
+		prefetchSync->wake.wait(lock, [] { return numPrefetchJobs > 0; });
+
+		const int slot = prefetchJobSlot[0];
+		const unsigned int index = prefetchJobIndex[0];
+		numPrefetchJobs--;
+		for (int j = 0; j < numPrefetchJobs; j++) {
+			prefetchJobSlot[j] = prefetchJobSlot[j + 1];
+			prefetchJobIndex[j] = prefetchJobIndex[j + 1];
 		}
+
+		lock.unlock();
+		const bool read = mbcReadPage(index, cachedBanks[slot]->bank, index != unsigned(mbc.numRomBanks * 4 - 1));
+		lock.lock();
+
+		cachedBankFailed[slot] = !read;
+		cachedBankLoading[slot] = 0;
+		numPrefetchInFlight--;
+		prefetchSync->done.notify_all();
+	}
+}
+
+// waits for the worker to finish with the slot, false if the read failed
+static bool prefetchWait(int slot) {
+	if (!prefetchSync)
+		return true;
+
+	std::unique_lock<std::mutex> lock(prefetchSync->mutex);
+	if (cachedBankLoading[slot]) {
+		const unsigned int start = mbcMicroseconds();
+		prefetchSync->done.wait(lock, [slot] { return cachedBankLoading[slot] == 0; });
+		mbcStats.prefetchWaitMicroseconds += mbcMicroseconds() - start;
+	}
+	return !cachedBankFailed[slot];
+}
+
+// waits for every queued page, before anything the worker reads from changes
+static void prefetchDrain() {
+	if (!prefetchSync)
+		return;
+
+	std::unique_lock<std::mutex> lock(prefetchSync->mutex);
+	prefetchSync->done.wait(lock, [] { return numPrefetchInFlight == 0; });
+}
+#else
+static void prefetchDrain() {
+}
+#endif
+
+// empties the rom cache
+static void resetBankCache() {
+	prefetchDrain();
+
+	for (int i = 0; i < MAX_ROM_PAGES; i++) {
+		cachedPageSlot[i] = -1;
+	}
+	for (int i = 0; i < MAX_CACHED_BANKS; i++) {
+		cachedBankIndex[i] = 0xFFFFFFFF;
+		cachedBankReferenced[i] = 0;
 	}
+	cacheHand = 0;
+	numPinnedPages = 0;
+
+#if MBC_PREFETCH
+	memset(bankSuccessor, 0, sizeof(bankSuccessor));
+	memset(bankConfidence, 0, sizeof(bankConfidence));
+	memset(cachedBankPrefetched, 0, sizeof(cachedBankPrefetched));
+	prefetchLeft = 0;
+#endif
+#if MBC_PREFETCH_THREAD
+	memset(cachedBankFailed, 0, sizeof(cachedBankFailed));
+#endif
+}
+
+// frees up a slot for the given page with the CLOCK hand, the first slot not used since the hand last went around.
+// Pages of the selected bank are mapped in and are never replaced
+static int cacheVictim(unsigned int index) {
+	int slot;
+	for (;;) {
+		if (cacheHand < numPinnedPages || cacheHand >= numCachedBanks) {
+			cacheHand = numPinnedPages;
+		}
+		slot = cacheHand++;
 
-	int minSlot = firstRomCache;
-	for (int i = firstRomCache; i < NUM_CACHED_BANKS; i++) {
-		if (cachedBankIndex[i] == index) {
-			lastCacheRequestIndex[i] = cacheIndex;
-			return cachedBanks[i];
-		} 
-		if (lastCacheRequestIndex[i] < lastCacheRequestIndex[minSlot]) {
-			minSlot = i;
+#if MBC_PREFETCH_THREAD
+		if (cachedBankLoading[slot])
+			continue;
+#endif
+		if (cachedBankReferenced[slot]) {
+			cachedBankReferenced[slot] = 0;
+		} else if (cachedBankIndex[slot] == 0xFFFFFFFF || cachedBankIndex[slot] / 4 != mbc.romBank) {
+			break;
 		}
 	}
 
-	// uncached! using minimum cache request index, read into slot from file and return
-	if (!mbcReadPage(index, cachedBanks[minSlot]->bank,  index != unsigned(mbc.numRomBanks * 4 - 1))) {
+	if (cachedBankIndex[slot] != 0xFFFFFFFF) {
+		mbcStats.cacheEvictions++;
+		cachedPageSlot[cachedBankIndex[slot]] = -1;
+		cachedBankIndex[slot] = 0xFFFFFFFF;
+	}
+
+	cachedBankGeneration[slot]++;
+	for (int i = 0x40; i <= 0x7f; i++) {
+		// the slot may be mapped in and currently running
+		cpuPageTouched(i);
+	}
+
+	cachedBankIndex[slot] = index;
+	cachedBankReferenced[slot] = 1;
+	cachedPageSlot[index] = slot;
+#if MBC_PREFETCH
+	cachedBankPrefetched[slot] = 0;
+#endif
+	return slot;
+}
+
+#if MBC_PROFILE
+// times each rom page was looked up in the cache and times that missed, halved for each older session
+static unsigned short pageAccesses[MAX_ROM_PAGES];
+static unsigned short pageMisses[MAX_ROM_PAGES];
+static bool profileRecorded = false;
+
+inline void profileCount(unsigned short& count) {
+	if (count != 0xFFFF) {
+		count++;
+	}
+	profileRecorded = true;
+}
+#endif
+
+// returns the cached rom bank (or caches it) with the given index (which is a a factor of the number of caches per rom bank)
+mbc_bankcache* cacheBank(unsigned int index) {
+	DebugAssert(index < MAX_ROM_PAGES);
+
+#if MBC_PROFILE
+	profileCount(pageAccesses[index]);
+#endif
+
+	int slot = cachedPageSlot[index];
+	if (slot >= 0) {
+#if MBC_PREFETCH_THREAD
+		if (!prefetchWait(slot)) {
+			// worker couldn't read it, take the slot back and read it here
+			cachedPageSlot[index] = -1;
+			cachedBankIndex[slot] = 0xFFFFFFFF;
+			cachedBankFailed[slot] = 0;
+			return cacheBank(index);
+		}
+#endif
+		mbcStats.cacheHits++;
+		cachedBankReferenced[slot] = 1;
+#if MBC_PREFETCH
+		if (cachedBankPrefetched[slot]) {
+			cachedBankPrefetched[slot] = 0;
+			mbcStats.prefetchHits++;
+		}
+#endif
+		return cachedBanks[slot];
+	}
+
+	mbcStats.cacheMisses++;
+#if MBC_PROFILE
+	profileCount(pageMisses[index]);
+#endif
+
+	// uncached! read into a free slot from file and return
+	slot = cacheVictim(index);
+#if MBC_PREFETCH
+	const unsigned int start = mbcMicroseconds();
+#endif
+	if (!mbcReadPage(index, cachedBanks[slot]->bank,  index != unsigned(mbc.numRomBanks * 4 - 1))) {
 		// attempt to escape
+		cachedPageSlot[index] = -1;
+		cachedBankIndex[slot] = 0xFFFFFFFF;
 		keys.exit = true;
 		return cachedBanks[0];
+	}
+#if MBC_PREFETCH
+	mbcStats.missMicroseconds += mbcMicroseconds() - start;
+#endif
+
+	return cachedBanks[slot];
+}
+
+// whether switched rom banks are copied out of the file into the bank cache
+static bool romCopied() {
+#if ROM_ZERO_COPY
+	return mbc.compressed != 0;
+#else
+	return true;
+#endif
+}
+
+#if MBC_PREFETCH || MBC_PROFILE
+// whether switched rom banks are read through the bank cache (so a miss stalls)
+static bool romUsesCache() {
+	return romCopied() && !romResident;
+}
+#endif
+
+#if MBC_PREFETCH
+// learns the switch from one bank to the next, and queues up the bank predicted to follow the new one
+static void prefetchPredict(unsigned char fromBank, unsigned char toBank) {
+	if (bankSuccessor[fromBank] == toBank) {
+		if (bankConfidence[fromBank] < 3) {
+			bankConfidence[fromBank]++;
+		}
+	} else if (bankConfidence[fromBank] > 1) {
+		bankConfidence[fromBank]--;
 	} else {
-		cachedBankIndex[minSlot] = index;
-		lastCacheRequestIndex[minSlot] = cacheIndex;
+		bankSuccessor[fromBank] = toBank;
+		bankConfidence[fromBank] = 1;
+	}
+
+	prefetchLeft = 0;
+	if (bankConfidence[toBank] && bankSuccessor[toBank] != toBank && bankSuccessor[toBank] < mbc.numRomBanks && romUsesCache()) {
+		prefetchIndex = bankSuccessor[toBank] * 4;
+		prefetchLeft = 4;
+
+#if MBC_PREFETCH_THREAD
+		// the worker doesn't hold up emulation, so start right away
+		mbcPrefetch();
+#endif
+	}
+}
+
+void mbcPrefetch() {
+	for (; prefetchLeft; prefetchLeft--, prefetchIndex++) {
+		if (cachedPageSlot[prefetchIndex] >= 0)
+			continue;
+
+		const int slot = cacheVictim(prefetchIndex);
+		cachedBankReferenced[slot] = 0;
+		cachedBankPrefetched[slot] = 1;
+		mbcStats.prefetches++;
+
+#if MBC_PREFETCH_THREAD
+		if (!prefetchSync) {
+			prefetchSync = new mbc_prefetchsync;
+			std::thread(prefetchWorker).detach();
+		}
+		std::lock_guard<std::mutex> lock(prefetchSync->mutex);
+		cachedBankLoading[slot] = 1;
+		prefetchJobSlot[numPrefetchJobs] = slot;
+		prefetchJobIndex[numPrefetchJobs] = prefetchIndex;
+		numPrefetchJobs++;
+		numPrefetchInFlight++;
+		prefetchSync->wake.notify_one();
+#else
+		if (!mbcReadPage(prefetchIndex, cachedBanks[slot]->bank, prefetchIndex != unsigned(mbc.numRomBanks * 4 - 1))) {
+			cachedPageSlot[prefetchIndex] = -1;
+			cachedBankIndex[slot] = 0xFFFFFFFF;
+			cachedBankPrefetched[slot] = 0;
+		}
+#endif
+	}
+}
+#endif
+
+#if MBC_PROFILE
+// .prf file layout, the header followed by the access then miss counts of every page
+struct mbc_profileheader {
+	char magic[4];					// "PRF1"
+	unsigned int numPages;			// 4k pages in the ROM
+};
+
+// pages need to have been looked up this often to be pinned
+#define PROFILE_MIN_ACCESSES 2
+
+// slots always left for replacement, the selected and the predicted bank plus some room for the rest
+#define PROFILE_MIN_EVICTABLE 16
+
+// reads the hottest pages of the profile into the first slots, as many as fit with PROFILE_MIN_EVICTABLE
+// slots to spare. What's left of the cache is replaced as usual
+static void pinProfiledPages() {
+	const unsigned int numPages = mbc.numRomBanks * 4;
+	const unsigned int maxPinned = numCachedBanks > PROFILE_MIN_EVICTABLE ? numCachedBanks - PROFILE_MIN_EVICTABLE : 0;
+
+	resetBankCache();
+
+	while (numPinnedPages < maxPinned) {
+		// bank 0 is always in memory
+		int best = -1;
+		unsigned short bestAccesses = PROFILE_MIN_ACCESSES - 1;
+		for (unsigned int i = 4; i < numPages; i++) {
+			if (cachedPageSlot[i] < 0 && pageAccesses[i] > bestAccesses) {
+				best = i;
+				bestAccesses = pageAccesses[i];
+			}
+		}
+		if (best < 0)
+			break;
+
+		const int slot = numPinnedPages;
+		if (!mbcReadPage(best, cachedBanks[slot]->bank, best != int(numPages - 1)))
+			break;
+
+		cachedBankIndex[slot] = best;
+		cachedBankGeneration[slot]++;
+		cachedPageSlot[best] = slot;
+		numPinnedPages++;
+	}
+
+	mbcStats.pinnedPages = numPinnedPages;
+
+	// the selected bank was in the slots that were just loaded
+	mapRomBank();
+}
+
+void mbcLoadProfile(const char* filepath) {
+	memset(pageAccesses, 0, sizeof(pageAccesses));
+	memset(pageMisses, 0, sizeof(pageMisses));
+	profileRecorded = false;
+
+	const unsigned int numPages = mbc.numRomBanks * 4;
+	if (!romUsesCache() || numPages > MAX_ROM_PAGES)
+		return;
+
+	unsigned short pFile[256];
+	Bfile_StrToName_ncpy(pFile, (const char*)filepath, strlen(filepath) + 2);
+
+	int hFile = Bfile_OpenFile_OS(pFile, READ, 0); // Get handle
+	if (hFile < 0) {
+		// no profile yet
+		return;
+	}
+
+	mbc_profileheader header;
+	const int countSize = numPages * sizeof(unsigned short);
+	bool read =
+		Bfile_ReadFile_OS(hFile, &header, sizeof(header), 0) == sizeof(header) &&
+		!memcmp(header.magic, "PRF1", 4) && header.numPages == numPages &&
+		Bfile_ReadFile_OS(hFile, pageAccesses, countSize, -1) == countSize &&
+		Bfile_ReadFile_OS(hFile, pageMisses, countSize, -1) == countSize;
+	Bfile_CloseFile_OS(hFile);
+
+	if (!read) {
+		// wrong ROM or cut short, start over
+		memset(pageAccesses, 0, sizeof(pageAccesses));
+		memset(pageMisses, 0, sizeof(pageMisses));
+		return;
+	}
+
+	pinProfiledPages();
 
-		return cachedBanks[minSlot];
+	// older sessions count for half, so the profile follows where the game is played now
+	for (unsigned int i = 0; i < numPages; i++) {
+		pageAccesses[i] >>= 1;
+		pageMisses[i] >>= 1;
 	}
 }
 
+void mbcSaveProfile(const char* filepath) {
+	const unsigned int numPages = mbc.numRomBanks * 4;
+	if (!profileRecorded || numPages > MAX_ROM_PAGES)
+		return;
+
+	unsigned short pFile[256];
+	Bfile_StrToName_ncpy(pFile, (const char*)filepath, strlen(filepath) + 2);
+
+	mbc_profileheader header;
+	memcpy(header.magic, "PRF1", 4);
+	header.numPages = numPages;
+	const int countSize = numPages * sizeof(unsigned short);
+
+	int hFile = Bfile_OpenFile_OS(pFile, WRITE, 0); // Get handle
+	if (hFile < 0) {
+		// attempt to create
+		size_t wantedSize = sizeof(header) + countSize * 2;
+		if (Bfile_CreateEntry_OS(pFile, CREATEMODE_FILE, &wantedSize))
+			return;
+
+		hFile = Bfile_OpenFile_OS(pFile, WRITE, 0); // Get handle
+		if (hFile < 0) {
+			// create didn't work!
+			return;
+		}
+	}
+
+	Bfile_WriteFile_OS(hFile, &header, sizeof(header));
+	Bfile_WriteFile_OS(hFile, pageAccesses, countSize);
+	Bfile_WriteFile_OS(hFile, pageMisses, countSize);
+	Bfile_CloseFile_OS(hFile);
+
+	profileRecorded = false;
+}
+#endif
+
+// slots the rom needs at the least, the selected and the predicted bank
+#define MIN_ROM_CACHED_BANKS 8
+
+// heap kept free for allocations after the rom is loaded when the cache takes all it can get
+#define HEAP_RESERVE_CACHED_BANKS 4
+
+void mbcFreeCache() {
+	prefetchDrain();
+
+	while (numHeapCachedBanks) {
+		numHeapCachedBanks--;
+		free((void*) cachedBanks[numStackCachedBanks + numHeapCachedBanks]);
+		cachedBanks[numStackCachedBanks + numHeapCachedBanks] = NULL;
+	}
+	numCachedBanks = numStackCachedBanks;
+	romResident = false;
+}
+
+void mbcSizeCache() {
+	mbcFreeCache();
+
+	// enough for every rom page, ROM mapped straight from the file doesn't need more than the stack's
+	const unsigned int romPages = mbc.numRomBanks * 4;
+	unsigned int wanted = romCopied() ? romPages : numStackCachedBanks;
+	if (mbcCacheSlots) {
+		wanted = max(mbcCacheSlots, (unsigned int) MIN_ROM_CACHED_BANKS);
+	}
+	wanted = min(wanted, (unsigned int) MAX_CACHED_BANKS);
+
+	// hold the reserve while the cache is allocated so it only gets what's left over, no heap banks if it can't be had
+	void* reserve = malloc(HEAP_RESERVE_CACHED_BANKS * sizeof(mbc_bankcache));
+	while (reserve && numStackCachedBanks + numHeapCachedBanks < wanted) {
+		mbc_bankcache* bank = (mbc_bankcache*) malloc(sizeof(mbc_bankcache));
+		if (!bank)
+			break;
+		cachedBanks[numStackCachedBanks + numHeapCachedBanks++] = bank;
+	}
+	free(reserve);
+
+	numCachedBanks = min(wanted, numStackCachedBanks + numHeapCachedBanks);
+	if (!mbcCacheSlots) {
+		numCachedBanks = max(numCachedBanks, numStackCachedBanks);
+	}
+
+	romResident = romCopied() && numCachedBanks >= romPages;
+	romResidentLoaded = false;
+	resetBankCache();
+}
+
+bool mbcRomResident() {
+	return romResident;
+}
+
+// reads every page of the ROM into the cache, falls back to replacing pages if one can't be read
+static void loadResidentRom() {
+	const unsigned int romPages = mbc.numRomBanks * 4;
+	for (unsigned int i = 0; i < romPages; i++) {
+		const int slot = i;
+		if (!mbcReadPage(i, cachedBanks[slot]->bank, i != romPages - 1)) {
+			romResident = false;
+			resetBankCache();
+			return;
+		}
+
+		cachedBankIndex[slot] = i;
+		cachedBankGeneration[slot]++;
+		cachedPageSlot[i] = slot;
+	}
+
+	romResidentLoaded = true;
+}
+
 // total number of rom banks calculation (16k per bank)
 unsigned short numSwitchableBanksFromType(unsigned char romSizeByte) {
 	unsigned int numTotalBanks = 2 << romSizeByte;
 	return numTotalBanks;
 }
 
+// maps all 4 pages of the selected rom bank into 0x4000-0x7FFF
+static void mapRomBank() {
+	for (int nibble = 0; nibble < 4; nibble++) {
+		const unsigned int index = mbc.romBank * 4 + nibble;
+		const int firstPage = 0x40 + (nibble << 4);
+
+#if ROM_ZERO_COPY
+		// uncompressed ROMs are read straight from the file's blocks
+		if (!mbc.compressed && index < (unsigned int) numBlockAddresses) {
+			unsigned char* block = BlockAddresses[index];
+			for (int i = 0; i < 15; i++) {
+				readMap[firstPage + i] = &block[256 * i];
+				cpuPageTouched(firstPage + i);
+			}
+
+			if (index + 1 < (unsigned int) numBlockAddresses && BlockAddresses[index + 1] == block + 0x1000) {
+				readMap[firstPage + 15] = &block[256 * 15];
+			} else {
+				unsigned char* shadow = romShadow[nibble];
+				memcpy(shadow, &block[256 * 15], 256);
+				if (index + 1 < (unsigned int) numBlockAddresses) {
+					memcpy(&shadow[256], BlockAddresses[index + 1], 2);
+				} else {
+					shadow[256] = shadow[257] = 0;
+				}
+				readMap[firstPage + 15] = shadow;
+			}
+			cpuPageTouched(firstPage + 15);
+			continue;
+		}
+#endif
+
+		// a resident ROM needs no lookup
+		mbc_bankcache* cache = romResident ? cachedBanks[index] : cacheBank(index);
+
+		for (int i = 0; i < 16; i++) {
+			readMap[firstPage + i] = &cache->bank[256 * i];
+			cpuPageTouched(firstPage + i);
+		}
+	}
+}
+
+#if ROM_ZERO_COPY
+bool mbcIsRomShadow(const unsigned char* host) {
+	return host >= &romShadow[0][0] && host < &romShadow[0][0] + sizeof(romShadow);
+}
+#endif
+
 // selects the given rom bank
 void selectRomBank(unsigned char bankNum) {
 	if (bankNum < mbc.numRomBanks && bankNum != mbc.romBank) {
+#if MBC_PREFETCH
+		const unsigned char fromBank = mbc.romBank;
+#endif
 		mbc.romBank = bankNum;
+		mbcStats.romBankSwitches++;
 
-		// invalidate addresses in memory map for reading
-		for (int i = 0x40; i <= 0x7f; i++) {
-			specialMap[i] |= 0x10;
-		}
+		mapRomBank();
+
+#if MBC_PREFETCH
+		prefetchPredict(fromBank, bankNum);
+#endif
 	}
 }
 
 unsigned char mbcRead(unsigned short address) {
 	DebugAssert(address >= 0x4000 && address <= 0x7FFF);
 
-	unsigned char highNibble = address >> 12;
-	mbc_bankcache* cache = cacheBank(mbc.romBank * 4 + highNibble - 4);
+	// only before mbcFileUpdate has mapped the selected bank in (rom load, state load)
+	mapRomBank();
+
+	return readMap[address >> 8][address & 0xFF];
+}
+
+// bytes of sramArena that can be mapped in
+static unsigned int sramArenaSize() {
+	return sramArena == sram ? sizeof(sram) : getRAMSize();
+}
 
-	for (int i = 0; i < 16; i++) {
-		// map the cache
-		memoryMap[(highNibble << 4) + i] = &cache->bank[256 * i];
-		// we've validated the highest nibble
-		specialMap[(highNibble << 4) + i] &= ~0x10;
+static bool sramPageDirty(unsigned int arenaPage) {
+	return (sramDirty[arenaPage >> 5] & (1 << (arenaPage & 31))) != 0;
+}
+
+// maps a page of sramArena in, only writable once it is dirty
+static void mapSRAMPage(int page, unsigned char* host) {
+	readMap[page] = host;
+	writeMap[page] = sramPageDirty((host - sramArena) >> 8) ? host : NULL;
+}
+
+// unmaps the mapped in pages of sramArena for writing, so the next write to each goes through mbcSRAMWrite
+static void trapSRAMWrites() {
+	for (int i = 0xa0; i <= 0xbf; i++) {
+		if (writeMap[i] >= sramArena && writeMap[i] < sramArena + sramArenaSize()) {
+			writeMap[i] = NULL;
+		}
 	}
+}
 
-	return memoryMap[address >> 8][address & 0xFF];
+void mbcSRAMWrite(unsigned int address, unsigned char value) {
+	unsigned char* host = readMap[address >> 8];
+	if (host == rtcMap) {
+		// selected mbc3 rtc register
+		rtcWrite(value);
+		return;
+	}
+
+	if (host < sramArena || host >= sramArena + sramArenaSize()) {
+		// disabled, writes are lost
+		return;
+	}
+
+	const unsigned int arenaPage = (host - sramArena) >> 8;
+	if (!sramPageDirty(arenaPage)) {
+		sramDirty[arenaPage >> 5] |= 1 << (arenaPage & 31);
+		sramDirtyPages++;
+	}
+	sramQuietFrames = 0;
+	sramSaveFailed = false;
+
+	writeMap[address >> 8] = host;
+	host[address & 0xFF] = value;
+	cpuPageTouched(address >> 8);
 }
 
 // selects the given ram bank
 void selectRamBank(unsigned char bankNum, bool force = false) {
 	if ((bankNum != mbc.ramBank || force) && bankNum < mbc.numRamBanks) {
-		// map memory to our usurped rom cache area
-		for (int i = 0; i < 16; i++) {
-			memoryMap[0xa0 + i] = &cachedBanks[bankNum * 2]->bank[i << 8];
-		}
-		for (int i = 0; i < 16; i++) {
-			memoryMap[0xb0 + i] = &cachedBanks[bankNum * 2+1]->bank[i << 8];
+		unsigned char* bank = &sramArena[bankNum * 0x2000];
+		for (int i = 0; i < 32; i++) {
+			mapSRAMPage(0xa0 + i, &bank[i << 8]);
+			cpuPageTouched(0xa0 + i);
 		}
 		mbc.ramBank = bankNum;
 	}
@@ -297,7 +962,8 @@ void enableSRAM() {
 	if (mbc.numRamBanks <= 1) {
 		int nibbleCount = ramNibbleCount(mbc.ramType);
 		for (int i = 0; i < nibbleCount; i++) {
-			memoryMap[0xa0 + i] = &sram[i << 8];
+			mapSRAMPage(0xa0 + i, &sramArena[i << 8]);
+			cpuPageTouched(0xa0 + i);
 		}
 	} else {
 		selectRamBank(mbc.ramBank, true);
@@ -308,7 +974,9 @@ void enableSRAM() {
 void disableSRAM() {
 	mbc.sramEnabled = 0;
 	for (int i = 0xa0; i <= 0xbf; i++) {
-		memoryMap[i] = &disabledArea[0];
+		readMap[i] = &disabledArea[0];
+		writeMap[i] = NULL;
+		cpuPageTouched(i);
 	}
 }
 
@@ -384,11 +1052,6 @@ bool mbcIsRTC() {
 #define RTC_DAYS 0x0B
 #define RTC_CTL 0x0C
 
-void rtcLatch() {
-	// latch
-	rtc.curRTC = rtcToSeconds() - rtc.rtcBase;
-}
-
 int rtcGetLatched(int forReg) {
 	switch (forReg) {
 		case RTC_SEC:
@@ -412,18 +1075,15 @@ int rtcGetLatched(int forReg) {
 	return 0;
 }
 
-void rtcCheckDirty() {
-	// check for dirty rtc value if a register is selected (it's about to change)
-	if (rtc.rtcReg) {
-		unsigned char newValue = rtc.rtcValue;
-
-		for (int i = 0; i < 256; i++) {
-			if (rtcMap[i] != rtc.rtcValue) {
-				newValue = rtcMap[i];
-				break;
-			}
-		}
+// fills the page mapped in for the selected rtc register with its value
+static void rtcFillMap() {
+	for (int i = 0; i < 256; i++) {
+		rtcMap[i] = rtc.rtcValue;
+	}
+}
 
+static void rtcWrite(unsigned char newValue) {
+	if (rtc.rtcReg) {
 		if (newValue != rtc.rtcValue) {
 			// update rtc base (or halt) according to type of value selected
 			int diff = newValue - (int) rtc.rtcValue;
@@ -480,34 +1140,56 @@ void rtcCheckDirty() {
 			}
 
 			rtc.rtcValue = newValue;
+			rtcFillMap();
 		}
 	}
 }
 
+void rtcLatch() {
+	// latch
+	rtc.curRTC = rtcToSeconds() - rtc.rtcBase;
+
+	// the selected register reads back the new latched value
+	if (rtc.rtcReg) {
+		rtc.rtcValue = rtcGetLatched(rtc.rtcReg);
+		rtcFillMap();
+	}
+}
+
 void rtcSelectReg(unsigned char reg) {
 	rtc.rtcReg = reg;
 
 	rtc.rtcValue = rtcGetLatched(reg);
 	
-	// update rtcmap and point memory to it
-	for (int i = 0; i < 256; i++) {
-		rtcMap[i] = rtc.rtcValue;
-	}
+	// update rtcmap and point memory to it, writes go through rtcWrite
+	rtcFillMap();
 	for (int i = 0xa0; i <= 0xbf; i++) {
-		memoryMap[i] = &rtcMap[0];
+		readMap[i] = &rtcMap[0];
+		writeMap[i] = NULL;
+		cpuPageTouched(i);
 	}
 }
 
 bool setupMBCType(mbcType type, unsigned char romSizeByte, unsigned char ramSizeByte, int fileID) {
 	memset(&mbc, 0, sizeof(mbc));
+	memset(&mbcStats, 0, sizeof(mbcStats));
 	memset(&rtc, 0, sizeof(rtc));
-	memset(cachedBankIndex, 0, sizeof(cachedBankIndex));
-	memset(lastCacheRequestIndex, 0, sizeof(lastCacheRequestIndex));
-	cacheIndex = 0;
+	resetBankCache();
+	freeRAMBanks();
+
+	memset(sramDirty, 0, sizeof(sramDirty));
+	sramDirtyPages = 0;
+	sramQuietFrames = 0;
+	sramFile = NULL;
 
 	mbc.romFile = fileID;
 	mbc.type = type;
-	mbc.romBank = 0;
+
+	// bank 1 is selected at start, mbcFileUpdate maps it in once the file can be read
+	mbc.romBank = 1;
+	for (int i = 0x40; i <= 0x7f; i++) {
+		readMap[i] = NULL;
+	}
 
 	switch (type) {
 		case ROM_PLAIN:
@@ -515,7 +1197,6 @@ bool setupMBCType(mbcType type, unsigned char romSizeByte, unsigned char ramSize
 			mbc.ramType = RAM_8KB;
 			mbc.numRomBanks = 2;
 			mbc.numRamBanks = 1;
-			selectRomBank(1);
 			enableSRAM();
 			return true;
 		case ROM_MBC2_BATTERY:
@@ -523,7 +1204,6 @@ bool setupMBCType(mbcType type, unsigned char romSizeByte, unsigned char ramSize
 		case ROM_MBC2:
 			mbc.ramType = RAM_MBC2;
 			mbc.numRomBanks = numSwitchableBanksFromType(romSizeByte);
-			selectRomBank(1);
 			break;
 		// support for MBC 1/3/5
 		case ROM_MBC1_RAM_BATT:
@@ -543,7 +1223,6 @@ bool setupMBCType(mbcType type, unsigned char romSizeByte, unsigned char ramSize
 		case ROM_MBC5:
 		case ROM_MBC5_RUMBLE:
 			mbc.numRomBanks = numSwitchableBanksFromType(romSizeByte);
-			selectRomBank(1);
 			break;
 		default:
 			return false;
@@ -641,8 +1320,6 @@ void mbcWrite(unsigned short address, unsigned char value) {
 		case ROM_MBC3_TIMER_BATT:
 		case ROM_MBC3_TIMER_RAM_BATT:
 			if (upperNibble <= 0x01) {
-				rtcCheckDirty();
-
 				if ((value & 0x0F) == 0x0A) {
 					enableSRAM();
 				} else {
@@ -661,7 +1338,6 @@ void mbcWrite(unsigned short address, unsigned char value) {
 				}
 			}
 			else if (upperNibble <= 0x05) {
-				rtcCheckDirty();
 				rtc.rtcReg = 0;
 
 				if (value < 0x08 || !mbcIsRTC()) {
@@ -709,26 +1385,20 @@ void mbcWrite(unsigned short address, unsigned char value) {
 }
 
 // SRAM saving / loading
-static unsigned int curRAMHash(int size) {
-	unsigned int ret = 0;
-
-	if (size <= 8192) {
-		for (int i = 0; i < size; i++) {
-			ret = ((ret << 5) + (ret >> 27)) ^ sram[i];
-		}
-	} else {
-		for (int b = 0; b <= size / 0x1000; b++) {
-			for (int i = 0; i < 0x1000; i++) {
-				ret = ((ret << 5) + (ret >> 27)) ^ cachedBanks[b]->bank[i];
-			}
-		}
-	}
-
-	return ret;
+static void clearSRAMDirty() {
+	memset(sramDirty, 0, sizeof(sramDirty));
+	sramDirtyPages = 0;
+	sramQuietFrames = 0;
+	sramSaveFailed = false;
+	trapSRAMWrites();
 }
 
 // attempts to load SRAM from the given file path, false on error
 bool tryLoadSRAM(const char* filepath) {
+	// saved to the same file as it changes
+	sramFile = filepath;
+	sramSaveFailed = false;
+
 	int sramSize = ramNibbleCount(mbc.ramType) * 256;
 	int rtcSize = mbcIsRTC() ? sizeof(rtc_state) : 0;
 
@@ -746,32 +1416,14 @@ bool tryLoadSRAM(const char* filepath) {
 			return false;
 		}
 
-		if (sramSize <= 8192) {
-			if (Bfile_ReadFile_OS(hFile, sram, sramSize, 0) == sramSize) {
-				sramHash = curRAMHash(sramSize);
+		// every ram bank is in the arena, in file order
+		if (Bfile_ReadFile_OS(hFile, sramArena, sramSize, 0) == sramSize) {
+			clearSRAMDirty();
 
-				// read rtc is we need it
-				if (!rtcSize || Bfile_ReadFile_OS(hFile, &rtc, rtcSize, -1) == rtcSize) {
-					Bfile_CloseFile_OS(hFile);
-					return true;
-				}
-			}
-		} else {
-			// read each bank
-			bool failed = false;
-			for (unsigned char i = 0; i < mbc.numRamBanks * 2; i++) {
-				if (Bfile_ReadFile_OS(hFile, &cachedBanks[i]->bank[0], 0x1000, i * 0x1000) != 0x1000) {
-					failed = true;
-				}
-			}
-			if (!failed) {
-				sramHash = curRAMHash(sramSize);
-
-				// read rtc is we need it
-				if (!rtcSize || Bfile_ReadFile_OS(hFile, &rtc, rtcSize, -1) == rtcSize) {
-					Bfile_CloseFile_OS(hFile);
-					return true;
-				}
+			// read rtc is we need it
+			if (!rtcSize || Bfile_ReadFile_OS(hFile, &rtc, rtcSize, -1) == rtcSize) {
+				Bfile_CloseFile_OS(hFile);
+				return true;
 			}
 		}
 
@@ -786,52 +1438,99 @@ bool tryLoadSRAM(const char* filepath) {
 	}
 }
 
-// attempts to save SRAM for a game to the given file path
-void trySaveSRAM(const char* filepath) {
+// attempts to save SRAM for a game to the given file path, false on error
+bool trySaveSRAM(const char* filepath) {
 	int sramSize = ramNibbleCount(mbc.ramType) * 256;
 	int rtcSize = mbcIsRTC() ? sizeof(rtc_state) : 0;
 
 	if (mbc.numRamBanks > 1) {
 		sramSize = 8192 * mbc.numRamBanks;
 	}
-	unsigned int curHash = curRAMHash(sramSize);
 
-	if (curHash != sramHash || rtcSize) {
+	if (sramDirtyPages || rtcSize) {
+		const unsigned int start = mbcMicroseconds();
+
 		unsigned short pFile[256];
 		Bfile_StrToName_ncpy(pFile, (const char*)filepath, strlen(filepath) + 2);
 
+		bool created = false;
 		int hFile = Bfile_OpenFile_OS(pFile, WRITE, 0); // Get handle
 		if (hFile < 0) {
 			// attempt to create
 			size_t wantedSize = sramSize + rtcSize;
 			if (Bfile_CreateEntry_OS(pFile, CREATEMODE_FILE, &wantedSize))
-				return;
+				return false;
 
 			hFile = Bfile_OpenFile_OS(pFile, WRITE, 0); // Get handle
 			if (hFile < 0) {
 				// create didn't work!
-				return;
+				return false;
 			}
+			created = true;
 		}
 
-		if (sramSize <= 8192) {
-			Bfile_WriteFile_OS(hFile, sram, sramSize);
-		} else {
-			// write each bank
-			for (unsigned char i = 0; i < mbc.numRamBanks * 2; i++) {
-				Bfile_WriteFile_OS(hFile, &cachedBanks[i]->bank[0], 0x1000);
+		// only the dirty runs of pages, unless the file is new
+		const int numPages = (sramSize + 255) / 256;
+		unsigned int pagesWritten = 0;
+		for (int page = 0; page < numPages; page++) {
+			if (!created && !sramPageDirty(page))
+				continue;
+
+			int end = page + 1;
+			while (end < numPages && (created || sramPageDirty(end))) {
+				end++;
 			}
+
+			const int size = min(end * 256, sramSize) - page * 256;
+			Bfile_SeekFile_OS(hFile, page * 256);
+			Bfile_WriteFile_OS(hFile, &sramArena[page * 256], size);
+			pagesWritten += end - page;
+			page = end;
 		}
 
 		if (rtcSize) {
+			Bfile_SeekFile_OS(hFile, sramSize);
 			Bfile_WriteFile_OS(hFile, &rtc, rtcSize);
 		}
 
 		Bfile_CloseFile_OS(hFile);
 
 		// now in sync with file system
-		sramHash = curHash;
+		clearSRAMDirty();
+
+		const unsigned int elapsed = mbcMicroseconds() - start;
+		mbcStats.sramSaves++;
+		mbcStats.sramPagesSaved += pagesWritten;
+		mbcStats.sramSaveMicroseconds += elapsed;
+		mbcStats.sramSaveMaxMicroseconds = max(mbcStats.sramSaveMaxMicroseconds, elapsed);
 	}
+
+	return true;
+}
+
+void mbcSaveTick() {
+	if (!sramDirtyPages || !sramFile || !sramAutoSaveFrames)
+		return;
+
+	if (sramSaveFailed || ++sramQuietFrames < sramAutoSaveFrames) {
+		// see if it's written to again before the next frame
+		trapSRAMWrites();
+		return;
+	}
+
+#if !TARGET_WINSIM && !TARGET_LINUX
+	// flush DMA before making OS calls
+	DmaWaitNext();
+#endif
+
+	if (!trySaveSRAM(sramFile)) {
+		// don't retry every frame, the next write to SRAM tries again once it's quiet
+		sramSaveFailed = true;
+		sramQuietFrames = 0;
+	}
+
+	// file I/O can move the rom's blocks
+	mbcFileUpdate();
 }
 
 // call after state save load for proper handling
@@ -844,10 +1543,6 @@ void mbcOnStateLoad() {
 
 	// invalidate memory areas for ROM bank
 	for (int i = 0x40; i <= 0x7f; i++) {
-		specialMap[i] |= 0x10;
-	}
-
-	if (getRAMSize() <= 8 * 1024) {
-		sramHash = curRAMHash(getRAMSize());
+		readMap[i] = NULL;
 	}
 }
\ No newline at end of file
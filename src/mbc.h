@@ -3,6 +3,54 @@
 // requires 4k per bank, allocated on stack on the Prizm
 #define NUM_CACHED_BANKS 48
 
+// more banks are allocated from the heap when a ROM is loaded, as many as it needs up to this and as far as the heap
+// allows. Can be overridden by defining MAX_HEAP_CACHED_BANKS
+#ifndef MAX_HEAP_CACHED_BANKS
+#define MAX_HEAP_CACHED_BANKS 64
+#endif
+#define MAX_CACHED_BANKS (NUM_CACHED_BANKS + MAX_HEAP_CACHED_BANKS)
+
+// total number of cached banks to use instead of sizing the cache from the ROM and heap, 0 to size it automatically.
+// Can be overridden by defining MBC_CACHE_SLOTS, or with mbcCacheSlots before the ROM is loaded
+#ifndef MBC_CACHE_SLOTS
+#define MBC_CACHE_SLOTS 0
+#endif
+
+// 4k pages in the largest supported ROM (4 MB)
+#define MAX_ROM_PAGES 1024
+
+// uncompressed ROM banks are mapped straight from the file's block addresses instead of being copied into the bank
+// cache. Can be overridden by defining ROM_ZERO_COPY as 0 or 1
+#ifndef ROM_ZERO_COPY
+#define ROM_ZERO_COPY 1
+#endif
+
+// learns which rom bank tends to follow each one and reads the predicted bank into the cache ahead of time (during
+// halts, vblank and frames with the lcd off). Only matters when banks go through the cache (compressed ROMs). Can be
+// overridden by defining MBC_PREFETCH as 0 or 1
+#ifndef MBC_PREFETCH
+#define MBC_PREFETCH 1
+#endif
+
+// the host build reads prefetched pages on a worker thread as soon as the bank is predicted
+#ifndef MBC_PREFETCH_THREAD
+#define MBC_PREFETCH_THREAD (MBC_PREFETCH && TARGET_LINUX)
+#endif
+
+// counts how often each rom page is looked up in the bank cache and saves that to a .prf file next to the ROM, the
+// next time the ROM is loaded its hottest pages are read in up front and pinned in the cache. Can be overridden by
+// defining MBC_PROFILE as 0 or 1
+#ifndef MBC_PROFILE
+#define MBC_PROFILE 1
+#endif
+
+// battery backed RAM is saved once it has gone this many frames without being written to (checked at vblank and with
+// the lcd off), only the 256 byte pages written since the last save are written out. 0 only saves when play stops. Can
+// be overridden by defining SRAM_AUTOSAVE_FRAMES, or with sramAutoSaveFrames
+#ifndef SRAM_AUTOSAVE_FRAMES
+#define SRAM_AUTOSAVE_FRAMES 120
+#endif
+
 enum mbcType {
 	ROM_PLAIN = 0x00,
 	ROM_MBC1 = 0x01,
@@ -59,11 +107,28 @@ struct mbc_state {
 	unsigned char sramEnabled;		// whether sram is currently enabled
 };
 
+// not part of the save state, reset with each ROM
+struct mbc_stats {
+	unsigned int romBankSwitches;	// times a different rom bank was selected and mapped in
+	unsigned int cacheHits;			// 4k rom page lookups found in the bank cache
+	unsigned int cacheMisses;		// 4k rom page lookups that had to be read from the file
+	unsigned int cacheEvictions;	// misses that replaced another cached page
+	unsigned int prefetches;		// pages read ahead of time for a predicted bank switch
+	unsigned int prefetchHits;		// prefetched pages that were used before being replaced
+	unsigned long long missMicroseconds;			// time spent reading pages on a miss
+	unsigned long long prefetchWaitMicroseconds;	// time spent waiting on the prefetch worker for a page it was reading
+	unsigned int pinnedPages;		// pages pinned in the cache from the rom's profile
+	unsigned int sramSaves;			// times battery RAM was saved
+	unsigned int sramPagesSaved;	// dirty 256 byte pages written by those saves
+	unsigned long long sramSaveMicroseconds;	// time spent saving battery RAM
+	unsigned int sramSaveMaxMicroseconds;		// longest save
+};
+
 struct rtc_state {
 	unsigned int rtcBase;			// device rtc base for current values
 	unsigned int curRTC;			// latched RTC value (in total seconds)
 	unsigned char rtcReg;			// current rtc selected register
-	unsigned char rtcValue;			// current rtc selected register value (to check for writes)
+	unsigned char rtcValue;			// current rtc selected register value (what reads of it return)
 	unsigned char lastLatch;		// last write to the latch data area (for determining rtc latch from 00->01)
 	unsigned char isHalted;			// whether RTC is currently halted (curRTC won't change)
 };
@@ -74,6 +139,7 @@ struct mbc_bankcache {
 };
 
 extern mbc_state mbc;
+extern mbc_stats mbcStats;
 extern rtc_state rtc;
 
 // returns false if type is not supported
@@ -82,8 +148,8 @@ bool setupMBCType(mbcType type, unsigned char romSizeByte, unsigned char ramSize
 // attempts to load SRAM from the given file path, false on error
 bool tryLoadSRAM(const char* filepath);
 
-// attempts to save SRAM for a game to the given file path
-void trySaveSRAM(const char* filepath);
+// attempts to save SRAM for a game to the given file path, false on error
+bool trySaveSRAM(const char* filepath);
 
 // given a mbcType returns a string description
 const char* getMBCTypeString(mbcType type);
@@ -100,20 +166,79 @@ void mbcOnStateLoad();
 // called when play begins or file I/O happens during gameplay
 void mbcFileUpdate();
 
-// pointers to each cached bank
-extern mbc_bankcache* cachedBanks[NUM_CACHED_BANKS];
+// sizes the bank cache for the loaded ROM, call once the ROM type and compression are known (before mbcFileUpdate).
+// A ROM that fits is read in whole and never replaced
+void mbcSizeCache();
+
+// frees the cached banks allocated from the heap for the ROM
+void mbcFreeCache();
+
+// whether every page of the ROM is held in the bank cache
+bool mbcRomResident();
+
+// pointers to each cached bank, the first NUM_CACHED_BANKS are on the stack and the rest from the heap
+extern mbc_bankcache* cachedBanks[MAX_CACHED_BANKS];
+
+// cached banks in use for the loaded ROM
+extern unsigned int numCachedBanks;
+extern unsigned int numHeapCachedBanks;
+
+// cartridge RAM, sram for up to 8 KB or one allocation of getRAMSize() for RAM banks
+extern unsigned char* sramArena;
+
+// forced number of cached banks, 0 to size the cache automatically
+extern unsigned int mbcCacheSlots;
+
+// bumped each time a cached bank slot is loaded with a different page (so anything derived from its contents is stale)
+extern unsigned int cachedBankGeneration[MAX_CACHED_BANKS];
 
 // compressed page locations for each rom file page
 extern int* compressedPages;
 
+#if ROM_ZERO_COPY
+// bumped each time the file's block addresses are looked up again (so anything decoded from mapped ROM is stale)
+extern unsigned int romMapGeneration;
+
+// whether the host address is in one of the pages holding the end of a mapped block
+bool mbcIsRomShadow(const unsigned char* host);
+#endif
+
+// frames without a battery RAM write before it is saved, 0 to only save when play stops
+extern unsigned int sramAutoSaveFrames;
+
+// first write to a page of cartridge RAM since it was last saved, a write to the selected rtc register, or to disabled RAM
+void mbcSRAMWrite(unsigned int address, unsigned char value);
+
+// called each frame at vblank (or with the lcd off), saves battery RAM once it has been left alone for a while
+void mbcSaveTick();
+
 // reads the page with the given ROM bank index (in 4k chunks) to the given memory address
 bool mbcReadPage(unsigned int bankIndex, unsigned char* target, bool instructionOverlap);
 
 // returns whether mbc uses RTC
 bool mbcIsRTC();
 
-// checks for a dirty rtc register, should only be done at opportune times
-void rtcCheckDirty();
+#if MBC_PREFETCH
+// reads any pages of the predicted next rom bank that aren't cached yet, called when the emulator has time to spare
+void mbcPrefetch();
+#else
+inline void mbcPrefetch() {
+}
+#endif
+
+#if MBC_PROFILE
+// loads the rom page profile from the given file path and pins its hottest pages in the cache, call once the file
+// can be read (after mbcFileUpdate)
+void mbcLoadProfile(const char* filepath);
+
+// saves the rom page profile to the given file path, if anything was recorded
+void mbcSaveProfile(const char* filepath);
+#else
+inline void mbcLoadProfile(const char* filepath) {
+}
+inline void mbcSaveProfile(const char* filepath) {
+}
+#endif
 
 // converts current device rtc values to useable seconds value;
 unsigned int rtcToSeconds();
@@ -10,6 +10,7 @@
 #include "cgb.h"
 #include "emulator.h"
 #include "snd/snd.h"
+#include "events.h"
 
 #include "memory.h"
 
@@ -34,7 +35,7 @@ const unsigned char ioReset[0x100] = {
 
 // Special read bytes (bit 0):
 //		0x00 : keyboard
-//		0x02 : Trx bit 7 will also read as 0 (since no serial transfer is currently supported)
+//		0x02 : Trx bit 7 reads as 0 unless an internal clock transfer is running (no external clock is ever connected)
 //		0x04 : DIV, upper 8 bits of internal cpu counter
 //      0x05 : TIMA, needs to be updated before being read
 //      0x08 - 0x0e : games are known to read from these and expect 0xFF for some reason
@@ -42,17 +43,20 @@ const unsigned char ioReset[0x100] = {
 //		0x41 : STAT is alway 1 in the high bit
 
 // Special write bytes (bit 1):
-//		0x02 : When enable serial trx, we need to issue an interrupt indicating no gameboy is present
+//		0x02 : When enable serial trx, we need to schedule the transfer that indicates no gameboy is present
 //		0x04 : DIV, any writes reset it
 //		0x05 : TIMA, writes to it need to adjust our internal timer also
 //		0x07 : TAC, writes to it MAY need to adjust our internal timer also
+//		0x0f : interrupt flags, writes may make an interrupt pending
 //		0x14,0x19,0x1E,0x23 : Sound channel init enable on bit 7
 //		0x26 : NR52, master sound control, avoid writes to sound channel active bits (read only)
 //		0x40 : Toggling the window off and on mid-frame effects the actual window draw position
 //		0x41 : writes to STAT causes interrupt flags in certain situations
 //		0x44 : gpu scanline (read only)
+//		0x42,0x43 : with CATCHUP_PPU, scroll writes render the pending lines first (set in resetMemoryMaps)
 //		0x46 : sprite DMA register (TODO, check clock cycles on this)
 //		0x47-49 : color palette writes require DMG palette resolves
+//		0x4A : with CATCHUP_PPU, window y writes render the pending lines first (set in resetMemoryMaps)
 //		0x4B : Window enable/disable mid frame effects window render position
 //		0x4D : CGB speed switch (only can change bit 0)
 //		0x4F : CGB VRAM select
@@ -62,9 +66,10 @@ const unsigned char ioReset[0x100] = {
 //		0x70 : CGB WRAM select
 //		0x76 : CGB mode unknown register (read only)
 //		0x77 : CGB mode unknown register (read only)
+//		0xff : interrupt enable, writes may make an interrupt pending
 unsigned char specialMap[256] ALIGN(256) =
 {
-	0x01, 0x00, 0x03, 0x00,  0x03, 0x03, 0x00, 0x02,  0x01, 0x01, 0x01, 0x01,  0x01, 0x01, 0x01, 0x01,
+	0x01, 0x00, 0x03, 0x00,  0x03, 0x03, 0x00, 0x02,  0x01, 0x01, 0x01, 0x01,  0x01, 0x01, 0x01, 0x03,
 	0x00, 0x00, 0x00, 0x00,  0x02, 0x00, 0x00, 0x00,  0x00, 0x02, 0x00, 0x00,  0x00, 0x00, 0x02, 0x00,
 	0x00, 0x00, 0x00, 0x02,  0x00, 0x00, 0x02, 0x00,  0x00, 0x00, 0x00, 0x00,  0x00, 0x00, 0x00, 0x00,
 	0x00, 0x00, 0x00, 0x00,  0x00, 0x00, 0x00, 0x00,  0x00, 0x00, 0x00, 0x00,  0x00, 0x00, 0x00, 0x00,
@@ -82,7 +87,7 @@ unsigned char specialMap[256] ALIGN(256) =
 	0x00, 0x00, 0x00, 0x00,  0x00, 0x00, 0x00, 0x00,  0x00, 0x00, 0x00, 0x00,  0x00, 0x00, 0x00, 0x00,
 	0x00, 0x00, 0x00, 0x00,  0x00, 0x00, 0x00, 0x00,  0x00, 0x00, 0x00, 0x00,  0x00, 0x00, 0x00, 0x00,
 	0x00, 0x00, 0x00, 0x00,  0x00, 0x00, 0x00, 0x00,  0x00, 0x00, 0x00, 0x00,  0x00, 0x00, 0x00, 0x00,
-	0x00, 0x00, 0x00, 0x00,  0x00, 0x00, 0x00, 0x00,  0x00, 0x00, 0x00, 0x00,  0x00, 0x00, 0x00, 0x00
+	0x00, 0x00, 0x00, 0x00,  0x00, 0x00, 0x00, 0x00,  0x00, 0x00, 0x00, 0x00,  0x00, 0x00, 0x00, 0x02
 };
 
 // forced alignment allows us to simply bitwise or in the memory map
@@ -95,20 +100,26 @@ unsigned char oam[0x100] ALIGN(256) = { 0 };
 
 unsigned char disabledArea[0x100] ALIGN(256);
 
-unsigned char* memoryMap[256] ALIGN(256) = { 0 };
+unsigned char* readMap[256] ALIGN(256) = { 0 };
+unsigned char* writeMap[256] ALIGN(256) = { 0 };
 
 void resetMemoryMaps(bool isCGB) {
 	// disabled RAM/ROM area should return all '1's
 	memset(disabledArea, 0xFF, sizeof(disabledArea));
 
+	// rom "writes" go to the memory bank controller
+	for (int i = 0x00; i <= 0x7f; i++) {
+		writeMap[i] = NULL;
+	}
+
 	// permanent rom area
 	for (int i = 0x00; i <= 0x3f; i++) {
-		memoryMap[i] = &cart[i << 8];
+		readMap[i] = &cart[i << 8];
 	}
 
 	// extra rom area starts out disabled
 	for (int i = 0x40; i <= 0x7f; i++) {
-		memoryMap[i] = &disabledArea[0];
+		readMap[i] = &disabledArea[0];
 	}
 
 	// video RAM needs to be allocated
@@ -123,41 +134,121 @@ void resetMemoryMaps(bool isCGB) {
 		memset(vram, 0, 0x2000);
 	}
 
+#if TILE_CACHE
+	tileCacheReset(isCGB);
+#endif
+#if VRAM_WRITE_TRACKING
+	// tile data writes update the tile cache, tile map writes the tile map surfaces and both mark lines dirty
+	bool trackVRAM = DIRTY_LINES || CATCHUP_PPU;
+#if TILE_CACHE
+	// the renderers decode from VRAM without the tile cache, nothing else may need the writes
+	trackVRAM |= tileCache != NULL;
+#endif
+	for (int i = 0x80; i <= 0x9f; i++) {
+		if (trackVRAM && i <= ((BG_SURFACE || DIRTY_LINES || CATCHUP_PPU) ? 0x9f : 0x97)) {
+			specialMap[i] |= 0x04;
+		} else {
+			specialMap[i] &= ~0x04;
+		}
+	}
+#endif
+#if CATCHUP_PPU
+	// the other display registers already have special writes
+	specialMap[0x42] |= 0x02;
+	specialMap[0x43] |= 0x02;
+	specialMap[0x4A] |= 0x02;
+	gpuPendingLines.count = 0;
+#endif
+
 	// first 8k of VRAM gets mapped by default
 	for (int i = 0x80; i <= 0x9f; i++) {
-		memoryMap[i] = &vram[(i - 0x80) << 8];
+		mapVRAMPage(i, &vram[(i - 0x80) << 8]);
 	}
 
 	// Sram starts out disabled
 	for (int i = 0xa0; i <= 0xbf; i++) {
-		memoryMap[i] = &disabledArea[0];
+		readMap[i] = &disabledArea[0];
+		writeMap[i] = NULL;
 	}
 
 	// permanent work ram and its echo
 	for (int i = 0xc0; i <= 0xcf; i++) {
-		memoryMap[i] = &wram_perm[(i - 0xc0) << 8];
-		memoryMap[i + 0x20] = &wram_perm[(i - 0xc0) << 8];
+		mapMemoryPage(i, &wram_perm[(i - 0xc0) << 8]);
+		mapMemoryPage(i + 0x20, &wram_perm[(i - 0xc0) << 8]);
 	}
 
 	// DMG work RAM / page 1 of CGB
 	for (int i = 0xd0; i <= 0xdf; i++) {
-		memoryMap[i] = &wram_gb[(i - 0xd0) << 8];
+		mapMemoryPage(i, &wram_gb[(i - 0xd0) << 8]);
 	}
 	// echo area of above ram
 	for (int i = 0xf0; i <= 0xfd; i++) {
-		memoryMap[i] = &wram_gb[(i - 0xe0) << 8];
+		mapMemoryPage(i, &wram_gb[(i - 0xe0) << 8]);
 	}
 
-	// on-chip/PPU memory
-	memoryMap[0xfe] = oam;
-	memoryMap[0xff] = cpu.memory.all;	// on chip memory
+	// on-chip/PPU memory, the registers all go through the special read/write handlers
+#if SPRITE_LISTS || CATCHUP_PPU
+	// OAM writes go through the slow path to mark the sprite lists for a rebuild and render the pending lines
+	readMap[0xfe] = oam;
+	writeMap[0xfe] = NULL;
+#else
+	mapMemoryPage(0xfe, oam);
+#endif
+	readMap[0xff] = NULL;
+	writeMap[0xff] = NULL;
 }
 
 void oamDMA(unsigned int sourceUpper) {
-	if (specialMap[sourceUpper] & 0x10)
-		mbcRead(sourceUpper << 8);
+	gpuCatchUp();
+	memcpy(oam, getInstrByte(sourceUpper << 8), 160);
+	oamChanged();
+}
+
+unsigned char* getInstrPageUnmapped(unsigned int address) {
+	if (address >= 0xFF00) {
+		return cpu.memory.all;
+	}
+
+	// the switched bank after a load, before mbcFileUpdate has mapped it in
+	mbcRead(address);
+	return readMap[address >> 8];
+}
 
-	memcpy(oam, memoryMap[sourceUpper], 160);
+void writeByteUnmapped(unsigned int address, unsigned char value) {
+	// special write cases happen at upper 256 bytes
+	if (address >= 0xff00) {
+		unsigned int operand = address & 0xFF;
+		if (specialMap[operand] & 0x02)
+			writeByteSpecial(operand, value);
+		else
+			cpu.memory.all[operand] = value;
+		cpuPageTouched(0xff);
+	}
+	// rom "write" goes to memory bank controller instead
+	else if ((address & 0x8000) == 0) {
+		mbcWrite(address, value);
+	}
+#if SPRITE_LISTS || CATCHUP_PPU
+	else if ((address >> 8) == 0xfe) {
+		// the pending lines (or the PPU thread) may still be drawing from OAM, only a change is passed on
+		if (oam[address & 0xFF] != value) {
+			gpuCatchUp();
+			oamChanged();
+		}
+		oam[address & 0xFF] = value;
+		cpuPageTouched(0xfe);
+	}
+#endif
+#if VRAM_WRITE_TRACKING
+	// VRAM the renderers keep track of
+	else if (specialMap[address >> 8] & 0x04) {
+		gpuWriteVRAM(address, value);
+	}
+#endif
+	// SRAM page that isn't dirty yet (or disabled SRAM, writes are lost)
+	else if (address >= 0xa000 && address < 0xc000) {
+		mbcSRAMWrite(address, value);
+	}
 }
 
 unsigned char readByteSpecial(unsigned int address) {
@@ -179,7 +270,10 @@ unsigned char readByteSpecial(unsigned int address) {
 			else return 0xff;
 		}
 		case 0x02: {
-			// also return transfer bit as 0
+			// transfer bit stays set until an internal clock transfer completes, external clock ones never start
+			if ((cpu.memory.SC_serial_ctl & 0x81) == 0x81) {
+				return cpu.memory.SC_serial_ctl;
+			}
 			return cpu.memory.SC_serial_ctl & 0x7F;
 		}
 		case 0x04: {
@@ -200,7 +294,7 @@ unsigned char readByteSpecial(unsigned int address) {
 		case 0x0e:
 			return 0xff;
 		case 0x0f: return cpu.memory.IF_intflag | 0xE0;	// top 3 bits are always set when reading interrupt flags
-		case 0x41: return cpu.memory.STAT_lcdstatus | 0x80;	// high bit always set in STAT
+		case 0x41: return (cpu.memory.STAT_lcdstatus & ~STAT_MODE) | gpuLCDMode() | 0x80;	// high bit always set in STAT
 		default:
 			return cpu.memory.all[byte];
 	}
@@ -212,10 +306,8 @@ void writeByteSpecial(unsigned int address, unsigned char value) {
 		case 0x02:
 			cpu.memory.SC_serial_ctl = value;
 			if ((value & 0x81) == 0x81) {
-				// "receive" 0xFF and trigger interrupt if enabled
-				cpu.memory.SB_serial_data = 0xFF;
-				cpu.memory.SC_serial_ctl &= 0x7F;
-				cpu.memory.IF_intflag |= INTERRUPTS_SERIAL;
+				// "receive" 0xFF and trigger interrupt if enabled once the byte is shifted out
+				serialStart();
 			}
 			break;
 		case 0x04:
@@ -229,6 +321,10 @@ void writeByteSpecial(unsigned int address, unsigned char value) {
 		case 0x07:
 			writeTAC(value);
 			break;
+		case 0x0f:
+			cpu.memory.IF_intflag = value;
+			eventInterruptChanged();
+			break;
 		case 0x14:
 			if (value & 0x80) {
 				sndChannelInit(1);
@@ -263,6 +359,10 @@ void writeByteSpecial(unsigned int address, unsigned char value) {
 			cpu.memory.NR52_soundmast = value;
 			break;
 		case 0x40:
+			if (cpu.memory.LCDC_ctl != value) {
+				gpuCatchUp();
+			}
+
 			// check for window bit change mid frame (ppu 'remembers' the position)
 			if ((cpu.memory.LCDC_ctl ^ value) & LCDC_WINDOWENABLE) {
 				if (value & LCDC_WINDOWENABLE) {
@@ -277,14 +377,35 @@ void writeByteSpecial(unsigned int address, unsigned char value) {
 					}
 				}
 			}
+			if ((cpu.memory.LCDC_ctl ^ value) & LCDC_SPRITEVDOUBLE) {
+				oamChanged();
+			}
+#if BG_SURFACE
+			// the tile map surfaces depend on the tile set
+			if ((cpu.memory.LCDC_ctl ^ value) & LCDC_TILESET) {
+				vramGeneration++;
+			}
+#endif
 			cpu.memory.LCDC_ctl = value;
 			break;
 		case 0x41:
+			// the interrupts need the mode transitions, and the mode bits are checked below
+			gpuLeaveFastLine();
 			cpu.memory.STAT_lcdstatus = (value & 0x78) | (cpu.memory.STAT_lcdstatus & 0x7);
 			// This may be a DMG only thing?
 			if ((GET_LCDC_MODE() == GPU_MODE_HBLANK || GET_LCDC_MODE() == GPU_MODE_VBLANK) && (cpu.memory.LCDC_ctl & 0x80)) {
 				cpu.memory.IF_intflag |= INTERRUPTS_LCDSTAT;
+				eventInterruptChanged();
+			}
+			break;
+		case 0x42:
+		case 0x43:
+		case 0x4A:
+			// only special with CATCHUP_PPU
+			if (cpu.memory.all[address] != value) {
+				gpuCatchUpScroll();
 			}
+			cpu.memory.all[address] = value;
 			break;
 		case 0x44: // read only
 			break;
@@ -292,24 +413,36 @@ void writeByteSpecial(unsigned int address, unsigned char value) {
 			oamDMA(value); // OAM DMA
 			break;
 		case 0x47:
+			if (cpu.memory.BGP_bgpalette != value) {
+				gpuCatchUp();
+			}
 			cpu.memory.BGP_bgpalette = value;
 			if (!cgb.isCGB) {
 				resolveDMGBGPalette();
 			}
 			break;
 		case 0x48:
+			if (cpu.memory.OBP0_spritepal0 != value) {
+				gpuCatchUp();
+			}
 			cpu.memory.OBP0_spritepal0 = value;
 			if (!cgb.isCGB) {
 				resolveDMGOBJ0Palette();
 			}
 			break;
 		case 0x49:
+			if (cpu.memory.OBP1_spritepal1 != value) {
+				gpuCatchUp();
+			}
 			cpu.memory.OBP1_spritepal1 = value;
 			if (!cgb.isCGB) {
 				resolveDMGOBJ1Palette();
 			}
 			break;
 		case 0x4B:
+			if (cpu.memory.WX_windowx != value) {
+				gpuCatchUpScroll();
+			}
 			if (cpu.memory.LCDC_ctl & LCDC_WINDOWENABLE) {
 				if (value < 0xA7 && cpu.memory.WX_windowx >= 0xA7) {
 					// re-enabling?
@@ -366,23 +499,31 @@ void writeByteSpecial(unsigned int address, unsigned char value) {
 		case 0x69:	// CGB BG palette write
 			if (cgb.isCGB) {
 				int index = cpu.memory.BGPI_bgpalindex & 0x3F;
+				if (cgb.paletteMemory[index] != value) {
+					gpuCatchUp();
+					cgb.dirtyPalette = true;
+					paletteChanged();
+				}
 				cgb.paletteMemory[index] = value;
 				if (cpu.memory.BGPI_bgpalindex & 0x80) {
 					index = (index + 1) & 0x3F;
 					cpu.memory.BGPI_bgpalindex = 0x80 | index;
 				}
-				cgb.dirtyPalette = true;
 			}
 			break;
 		case 0x6B:	// CGB OBJ palette write
 			if (cgb.isCGB) {
 				int index = cpu.memory.OBPI_objpalindex & 0x3F;
+				if (cgb.paletteMemory[64+index] != value) {
+					gpuCatchUp();
+					cgb.dirtyPalette = true;
+					paletteChanged();
+				}
 				cgb.paletteMemory[64+index] = value;
 				if (cpu.memory.OBPI_objpalindex & 0x80) {
 					index = (index + 1) & 0x3F;
 					cpu.memory.OBPI_objpalindex = 0x80 | index;
 				}
-				cgb.dirtyPalette = true;
 			}
 			break;
 		case 0x70:	// CGB WRAM select
@@ -395,5 +536,9 @@ void writeByteSpecial(unsigned int address, unsigned char value) {
 		case 0x76: // read only
 		case 0x77:
 			break;
+		case 0xff:
+			cpu.memory.IE_intenable = value;
+			eventInterruptChanged();
+			break;
 	}
 }
@@ -22,16 +22,30 @@ extern unsigned char oam[0x100] ALIGN(256);				// sprite memory, on gameboy
 // disabled RAM/ROM area
 extern unsigned char disabledArea[0x100] ALIGN(256);
 
-// maps high byte to different spots in memory
-extern unsigned char* memoryMap[256] ALIGN(256);
+// maps high byte to different spots in memory for reads and writes. A NULL page needs special handling (IO registers,
+// the switched ROM bank after a ROM or state load until mbcFileUpdate maps it, ROM writes to the MBC, disabled SRAM)
+// and goes to the slow path
+extern unsigned char* readMap[256] ALIGN(256);
+extern unsigned char* writeMap[256] ALIGN(256);
 
 // Specific bits used for different special mapping purposes:
 // Bit 0 : for high memory, specific bytes that need a special read
 // Bit 1 : for high memory, specific bytes that need a special write
-// Bit 2 : for most significant memory byte, whether a write requires a tile update (TODO, use mem directly in display code)
-// Bit 4 : for most significant memory byte, whether a read must validate the area first (switched bank)
+// Bit 2 : for most significant memory byte, whether a write requires a tile update (tile data with TILE_CACHE, all of VRAM with BG_SURFACE or DIRTY_LINES)
 extern unsigned char specialMap[256] ALIGN(256);
 
+// maps the page for both reading and writing
+inline void mapMemoryPage(unsigned int page, unsigned char* memory) {
+	readMap[page] = memory;
+	writeMap[page] = memory;
+}
+
+// maps a video RAM page, writes to pages that need a tile update go through the slow path
+inline void mapVRAMPage(unsigned int page, unsigned char* memory) {
+	readMap[page] = memory;
+	writeMap[page] = (specialMap[page] & 0x04) ? NULL : memory;
+}
+
 void resetMemoryMaps(bool isCGB);
 
 void copy(unsigned short destination, unsigned short source, size_t length);
@@ -39,16 +53,23 @@ void copy(unsigned short destination, unsigned short source, size_t length);
 unsigned char readByteSpecial(unsigned int address);
 void writeByteSpecial(unsigned int address, unsigned char value);
 
+// writes to a page with no write mapping (IO, MBC, tile data or disabled SRAM)
+void writeByteUnmapped(unsigned int address, unsigned char value);
+
+// page of an instruction address with no read mapping (IO, or the switched ROM bank before mbcFileUpdate maps it)
+unsigned char* getInstrPageUnmapped(unsigned int address);
+
 // called when a write attempt occurs for rom
 void mbcWrite(unsigned short address, unsigned char value);
 unsigned char mbcRead(unsigned short address);
 
 inline unsigned char readByte(unsigned int address) {
-	return ((address >= 0xff00 && (specialMap[address & 0xFF] & 0x01)) || (specialMap[address >> 8] & 0x10)) ? readByteSpecial(address) : memoryMap[address >> 8][address & 0xFF];
+	const unsigned char* page = readMap[address >> 8];
+	return page ? page[address & 0xFF] : readByteSpecial(address);
 }
 
 inline unsigned short readShort(unsigned int address) {
-	return readByte(address) | (readByte(address + 1) << 8);
+	return readByte(address) | (readByte((address + 1) & 0xFFFF) << 8);
 }
 
 inline unsigned int readShortFromStack(void) {
@@ -59,27 +80,18 @@ inline unsigned int readShortFromStack(void) {
 
 // branch avoidance. instructions will just have bad "reads" if somehow we are executing code off the on chip registers
 inline unsigned char* getInstrByte(unsigned int address) {
-	const unsigned char topBit = address >> 8;
-	if (specialMap[topBit] & 0x10) mbcRead(address);			// force flush of cached ROM page
-	return memoryMap[topBit] + (address & 0xFF);
+	unsigned char* page = readMap[address >> 8];
+	if (!page) page = getInstrPageUnmapped(address);			// force flush of cached ROM page
+	return page + (address & 0xFF);
 }
 
 inline void writeByte(unsigned int address, unsigned char value) {
-	// special write cases happen at upper 256 bytes
-	if ((address >> 8) == 0xff) {
-		unsigned int operand = address & 0xFF;
-		if (specialMap[operand] & 0x02)
-			writeByteSpecial(operand, value);
-		else
-			cpu.memory.all[operand] = value;
-	}
-	// rom "write" goes to memory bank controller instead
-	else if ((address & 0x8000) == 0) {
-		mbcWrite(address, value);
-	}
-	// else a normal byte write
-	else {
-		memoryMap[address >> 8][address & 0xFF] = value;
+	unsigned char* page = writeMap[address >> 8];
+	if (page) {
+		page[address & 0xFF] = value;
+		cpuPageTouched(address >> 8);
+	} else {
+		writeByteUnmapped(address, value);
 	}
 
 	// for debugging, usually compiles out
@@ -88,7 +100,7 @@ inline void writeByte(unsigned int address, unsigned char value) {
 
 inline void writeShort(unsigned int address, unsigned short value) {
 	writeByte(address, (unsigned char)(value & 0x00ff));
-	writeByte(address + 1, (unsigned char)(value >> 8));
+	writeByte((address + 1) & 0xFFFF, (unsigned char)(value >> 8));
 }
 
 inline void writeShortToStack(unsigned short value) {
@@ -4,6 +4,10 @@
 #include "string.h"
 #include "stdlib.h"
 
+#if TARGET_LINUX
+// headless host build, stands in for the subset of the fxcg API the emulation core uses
+#include "fxcg_linux.h"
+#else
 #include "fxcg\display.h"
 #include "fxcg\keyboard.h"
 #include "fxcg\file.h"
@@ -12,6 +16,7 @@
 #include "fxcg\system.h"
 #include "fxcg\serial.h"
 #include "fxcg\tmu.h"
+#endif
 
 #if TARGET_WINSIM
 #define ALIGN(x) alignas(x)
@@ -24,6 +29,13 @@ extern "C" {
 	int simmain(void);
 }
 
+#elif TARGET_LINUX
+#define ALIGN(x) __attribute__((aligned(x)))
+#define LITTLE_E
+#define FORCE_INLINE __attribute__((always_inline)) inline
+#define RESTRICT __restrict__
+#include <time.h>
+
 #else
 #define ALIGN(x) __attribute__((aligned(x)))
 #define BIG_E
@@ -10,6 +10,7 @@
 
 static char curRomFile[64];
 static char curSaveFile[64];
+static char curProfileFile[64];
 
 unsigned char loadROM(const char *filename) {
 	char name[17];
@@ -32,6 +33,9 @@ unsigned char loadROM(const char *filename) {
 	curSaveFile[extension+8] = 0;
 	strcat(curSaveFile, "SAV");
 
+	strcpy(curProfileFile, curSaveFile);
+	strcpy(curProfileFile + strlen(curProfileFile) - 3, "prf");
+
 	int hFile;
 	unsigned short pFile[256];
 	Bfile_StrToName_ncpy(pFile, (const char*)curRomFile, strlen(curRomFile)+2);
@@ -128,6 +132,9 @@ unsigned char loadROM(const char *filename) {
 		mbc.compressed = 0;
 	}
 
+	mbcSizeCache();
+	printf("Bank cache: %d x 4k (%d heap)%s\n", numCachedBanks, numHeapCachedBanks, mbcRomResident() ? ", ROM resident" : "");
+
 	mbcFileUpdate();
 		
 	// read permanent ROM Area in
@@ -136,6 +143,9 @@ unsigned char loadROM(const char *filename) {
 	mbcReadPage(2, &cart[0x2000], false);
 	mbcReadPage(3, &cart[0x3000], false);
 
+	// pin the pages this ROM used the most last time
+	mbcLoadProfile(curProfileFile);
+
 	if (mbc.batteryBacked) {
 		if (tryLoadSRAM(curSaveFile)) {
 			printf("Save file loaded\n");
@@ -157,12 +167,17 @@ void unloadROM(void) {
 	}
 
 	saveRAM();
+	saveProfile();
+	mbcFreeCache();
 
 	// free up vram
 	if (vram) {
 		free((void*)vram);
 		vram = NULL;
 	}
+#if TILE_CACHE
+	tileCacheFree();
+#endif
 
 	if (cgb.isCGB) {
 		// clean up CGB mode stuff
@@ -174,4 +189,8 @@ void saveRAM(void) {
 	if (mbc.batteryBacked) {
 		trySaveSRAM(curSaveFile);
 	}
+}
+
+void saveProfile(void) {
+	mbcSaveProfile(curProfileFile);
 }
\ No newline at end of file
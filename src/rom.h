@@ -8,4 +8,5 @@
 
 unsigned char loadROM(const char *filename);
 void unloadROM(void);
-void saveRAM(void);
\ No newline at end of file
+void saveRAM(void);
+void saveProfile(void);
\ No newline at end of file
@@ -100,7 +100,7 @@ void screen_play::play() {
 
 	// look for gameboy color palette override
 	if (!cgb.isCGB) {
-		if (!emulator.settings.useCGBColors || !getCGBTableEntry(&memoryMap[0][ROM_OFFSET_NAME], &ppuPalette[12])) {
+		if (!emulator.settings.useCGBColors || !getCGBTableEntry(&readMap[0][ROM_OFFSET_NAME], &ppuPalette[12])) {
 			colorpalette_type pal;
 			emulator.getPalette(emulator.settings.bgColorPalette, pal);
 			for (int i = 0; i < 4; i++) {
@@ -2,7 +2,7 @@
 extern unsigned int BitResolveTable[256];
 extern unsigned int BitResolveTableRev[256];
 
-#if TARGET_WINSIM
+#if TARGET_WINSIM || TARGET_LINUX
 
 FORCE_INLINE void BitsToScanline(unsigned char* scanline, unsigned int bits) {
 	DebugAssert((size_t(scanline) & 3) == 0);
@@ -34,6 +34,8 @@ FORCE_INLINE void BitsToScanline_Palette(unsigned char* scanline, unsigned int b
 FORCE_INLINE void BitsToScanline_Unsafe(unsigned char* scanline, unsigned int bits, unsigned int palette) {
 	palette |= palette << 8;
 	palette |= palette << 16;
+	// leftmost pixel is in the most significant byte, same as the aligned versions
+	EndianSwap(bits);
 	unsigned char* bitsChar = (unsigned char*) &bits;
 	scanline[0] = (bitsChar[0] & 0x0C) | palette;
 	scanline[1] = (bitsChar[1] & 0x0C) | palette;
@@ -86,3 +88,95 @@ FORCE_INLINE void resolveTileRowReversePal(unsigned int palette, unsigned char*
 	unsigned int bits = GetTableEntryRev(tileRow >> 8) | (GetTableEntryRev(tileRow & 0xFF) << 1);
 	isUnsafe ? BitsToScanline_Unsafe(scanline, bits, palette) : BitsToScanline_Palette(scanline, bits, palette);
 }
+
+#if TILE_CACHE
+
+// copies a decoded row from the tile cache to the scanline with the palette bits ORed in
+template<bool isUnsafe>
+FORCE_INLINE void copyTileRowPal(unsigned int palette, unsigned char* scanline, const unsigned char* row) {
+	if (isUnsafe) {
+		scanline[0] = row[0] | palette;
+		scanline[1] = row[1] | palette;
+		scanline[2] = row[2] | palette;
+		scanline[3] = row[3] | palette;
+		scanline[4] = row[4] | palette;
+		scanline[5] = row[5] | palette;
+		scanline[6] = row[6] | palette;
+		scanline[7] = row[7] | palette;
+	} else {
+		DebugAssert((size_t(scanline) & 3) == 0);
+
+		palette |= palette << 8;
+		palette |= palette << 16;
+		((unsigned int*)scanline)[0] = ((const unsigned int*)row)[0] | palette;
+		((unsigned int*)scanline)[1] = ((const unsigned int*)row)[1] | palette;
+	}
+}
+
+#endif
+
+// resolves the tile row at the given VRAM offset (tile * 16 + y * 2, + 0x2000 for CGB bank 1) to the scanline, from
+// the tile cache if it is enabled (and was allocated)
+template<bool isUnsafe>
+FORCE_INLINE void drawTileRowPal(unsigned int palette, unsigned char* scanline, unsigned int offset) {
+#if TILE_CACHE
+	if (tileCache) {
+		copyTileRowPal<isUnsafe>(palette, scanline, tileCacheRow(offset));
+		return;
+	}
+#endif
+	unsigned int tileRow = *((unsigned short*)&vram[offset]);
+	ShortSwap(tileRow);
+	resolveTileRowPal<isUnsafe>(palette, scanline, tileRow);
+}
+
+template<bool isUnsafe>
+FORCE_INLINE void drawTileRowReversePal(unsigned int palette, unsigned char* scanline, unsigned int offset) {
+#if TILE_CACHE
+	if (tileCache) {
+		copyTileRowPal<isUnsafe>(palette, scanline, tileCacheRow(offset) + 8);
+		return;
+	}
+#endif
+	unsigned int tileRow = *((unsigned short*)&vram[offset]);
+	ShortSwap(tileRow);
+	resolveTileRowReversePal<isUnsafe>(palette, scanline, tileRow);
+}
+
+template<bool isUnsafe>
+FORCE_INLINE void drawTileRow(unsigned char* scanline, unsigned int offset) {
+#if TILE_CACHE
+	if (tileCache) {
+		copyTileRowPal<isUnsafe>(0, scanline, tileCacheRow(offset));
+		return;
+	}
+#endif
+	unsigned int tileRow = *((unsigned short*)&vram[offset]);
+	ShortSwap(tileRow);
+	resolveTileRow<isUnsafe>(scanline, tileRow);
+}
+
+template<bool isUnsafe>
+FORCE_INLINE void drawTileRowReverse(unsigned char* scanline, unsigned int offset) {
+#if TILE_CACHE
+	if (tileCache) {
+		copyTileRowPal<isUnsafe>(0, scanline, tileCacheRow(offset) + 8);
+		return;
+	}
+#endif
+	unsigned int tileRow = *((unsigned short*)&vram[offset]);
+	ShortSwap(tileRow);
+	resolveTileRowReverse<isUnsafe>(scanline, tileRow);
+}
+
+// pixel colors of a tile row for sprite blending, points straight into the tile cache if it is enabled, otherwise
+// the row is resolved into the given buffer
+FORCE_INLINE const unsigned char* getTileRowColors(unsigned char* buffer, unsigned int offset, bool xflip) {
+#if TILE_CACHE
+	if (tileCache) {
+		return tileCacheRow(offset) + (xflip ? 8 : 0);
+	}
+#endif
+	xflip ? drawTileRowReverse<false>(buffer, offset) : drawTileRow<false>(buffer, offset);
+	return buffer;
+}
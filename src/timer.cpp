@@ -2,6 +2,7 @@
 #include "platform.h"
 #include "cpu.h"
 #include "interrupts.h"
+#include "events.h"
 
 // based on timer div freq
 int bitsToShift[4] = {
@@ -37,6 +38,12 @@ void updateTimer() {
 		cpu.timerInterrupt = 0xFFFFFFFF;
 	}
 	cpu.timerBase = cpu.clocks;
+
+	if (cpu.timerInterrupt != 0xFFFFFFFF) {
+		eventSchedule(EVENT_TIMER, cpu.timerInterrupt);
+	} else {
+		eventCancel(EVENT_TIMER);
+	}
 }
 
 void writeTIMA(unsigned char value) {